@@ -1,7 +1,12 @@
+#include <atomic>
 #include <cassert>
+#include <chrono>
 #include <cstddef>
+#include <mutex>
 #include <random>
 #include <set>
+#include <thread>
+#include <unordered_set>
 
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
@@ -9,6 +14,11 @@
 #define HSF_DEBUG
 #include "hsf/frequency.h"
 #include "hsf/recency.h"
+#include "hsf/sorted_array.h"
+#include "hsf/btree.h"
+#include "hsf/hash_table.h"
+#include "hsf/tuning.h"
+#include "hsf/sharded.h"
 
 #include "benchmark/treap.h"
 #include "benchmark/skiplist.h"
@@ -24,6 +34,22 @@ struct counting_comparator {
     }
 };
 
+template <size_t* Counter>
+struct counting_hash {
+    size_t operator()(int key) const {
+        ++(*Counter);
+        return std::hash<int>{}(key);
+    }
+};
+
+template <size_t* Counter>
+struct counting_equal {
+    bool operator()(int left, int right) const {
+        ++(*Counter);
+        return left == right;
+    }
+};
+
 static size_t f_forest_comparisons = 0;
 using f_forest_comparator = counting_comparator<&f_forest_comparisons>;
 using f_forest = hsf::frequency_forest<hsf::capacity, std::map, int, f_forest_comparator>;
@@ -40,6 +66,66 @@ static size_t learned_r_forest_comparisons = 0;
 using learned_r_forest_comparator = counting_comparator<&learned_r_forest_comparisons>;
 using learned_r_forest = hsf::learned_recency_forest<hsf::capacity, std::map, int, learned_r_forest_comparator>;
 
+static size_t filtered_f_forest_comparisons = 0;
+using filtered_f_forest_comparator = counting_comparator<&filtered_f_forest_comparisons>;
+using filtered_f_forest = hsf::basic_frequency_forest<hsf::bloom_filtered, hsf::capacity, std::map, int, filtered_f_forest_comparator>;
+
+static size_t filtered_r_forest_comparisons = 0;
+using filtered_r_forest_comparator = counting_comparator<&filtered_r_forest_comparisons>;
+using filtered_r_forest = hsf::basic_recency_forest<hsf::bloom_filtered, hsf::capacity, std::map, int, filtered_r_forest_comparator>;
+
+static size_t hashed_f_forest_comparisons = 0;
+static size_t hashed_f_forest_probes = 0;
+using hashed_f_forest = hsf::frequency_forest<hsf::capacity, hsf::hash_table, int, 
+    counting_hash<&hashed_f_forest_probes>, counting_equal<&hashed_f_forest_comparisons>>;
+
+static size_t hashed_learned_f_forest_comparisons = 0;
+static size_t hashed_learned_f_forest_probes = 0;
+using hashed_learned_f_forest = hsf::learned_frequency_forest<hsf::capacity, hsf::hash_table, int, 
+    counting_hash<&hashed_learned_f_forest_probes>, counting_equal<&hashed_learned_f_forest_comparisons>>;
+
+static size_t hashed_r_forest_comparisons = 0;
+static size_t hashed_r_forest_probes = 0;
+using hashed_r_forest = hsf::recency_forest<hsf::capacity, hsf::hash_table, int, 
+    counting_hash<&hashed_r_forest_probes>, counting_equal<&hashed_r_forest_comparisons>>;
+
+static size_t hash_table_comparisons = 0;
+static size_t hash_table_probes = 0;
+using counted_hash_table = hsf::hash_table<int, char, counting_hash<&hash_table_probes>, counting_equal<&hash_table_comparisons>>;
+
+using locked_f_forest = hsf::frequency_forest<hsf::capacity, std::map, int>;
+using concurrent_f_forest = hsf::concurrent_frequency_forest<hsf::capacity, std::map, int>;
+using concurrent_learned_f_forest = hsf::concurrent_learned_frequency_forest<hsf::capacity, std::map, int>;
+using concurrent_r_forest = hsf::concurrent_recency_forest<hsf::capacity, std::map, int>;
+using epoch_f_forest = hsf::basic_frequency_forest<hsf::epoch_reclaimed, hsf::capacity, std::map, int>;
+using epoch_learned_f_forest = hsf::basic_learned_frequency_forest<hsf::epoch_reclaimed, hsf::capacity, std::map, int>;
+
+using sharded_f_forest = hsf::sharded_forest<hsf::frequency_forest<hsf::capacity, std::map, int>>;
+using sharded_learned_f_forest = hsf::sharded_forest<hsf::learned_frequency_forest<hsf::capacity, std::map, int>>;
+using sharded_r_forest = hsf::sharded_forest<hsf::recency_forest<hsf::capacity, std::map, int>>;
+using sharded_learned_r_forest = hsf::sharded_forest<hsf::learned_recency_forest<hsf::capacity, std::map, int>>;
+
+using map_f_forest = hsf::frequency_forest<hsf::capacity, std::map, int>;
+using flat_f_forest = hsf::frequency_forest<hsf::capacity, hsf::sorted_array, int>;
+using map_learned_f_forest = hsf::learned_frequency_forest<hsf::capacity, std::map, int>;
+using flat_learned_f_forest = hsf::learned_frequency_forest<hsf::capacity, hsf::sorted_array, int>;
+using map_r_forest = hsf::recency_forest<hsf::capacity, std::map, int>;
+using flat_r_forest = hsf::recency_forest<hsf::capacity, hsf::sorted_array, int>;
+using btree_f_forest = hsf::frequency_forest<hsf::capacity, hsf::btree, int>;
+using btree_learned_f_forest = hsf::learned_frequency_forest<hsf::capacity, hsf::btree, int>;
+using btree_r_forest = hsf::recency_forest<hsf::capacity, hsf::btree, int>;
+using hash_f_forest = hsf::frequency_forest<hsf::capacity, hsf::hash_table, int>;
+using hash_learned_f_forest = hsf::learned_frequency_forest<hsf::capacity, hsf::hash_table, int>;
+using hash_r_forest = hsf::recency_forest<hsf::capacity, hsf::hash_table, int>;
+
+// Five levels of capacity(1.0, 2.0) hold over eight million keys; beyond
+// that the bottom level takes the rest.
+using fixed_policy = hsf::fixed_depth<5, hsf::single_threaded>;
+using fixed_f_forest = hsf::basic_frequency_forest<fixed_policy, hsf::capacity, std::map, int>;
+using fixed_flat_f_forest = hsf::basic_frequency_forest<fixed_policy, hsf::capacity, hsf::sorted_array, int>;
+using fixed_learned_f_forest = hsf::basic_learned_frequency_forest<fixed_policy, hsf::capacity, std::map, int>;
+using fixed_r_forest = hsf::basic_recency_forest<fixed_policy, hsf::capacity, std::map, int>;
+
 static size_t learned_treap_comparisons = 0;
 using learned_treap_comparator = counting_comparator<&learned_treap_comparisons>;
 using learned_treap = hsf::bench::treap<int, learned_treap_comparator>;
@@ -58,8 +144,18 @@ void reset_comparisons() {
     learned_f_forest_comparisons = 0;
     r_forest_comparisons = 0;
     learned_r_forest_comparisons = 0;
+    filtered_f_forest_comparisons = 0;
+    filtered_r_forest_comparisons = 0;
     learned_treap_comparisons = 0;
     robustsl_comparisons = 0;
+    hashed_f_forest_comparisons = 0;
+    hashed_f_forest_probes = 0;
+    hashed_learned_f_forest_comparisons = 0;
+    hashed_learned_f_forest_probes = 0;
+    hashed_r_forest_comparisons = 0;
+    hashed_r_forest_probes = 0;
+    hash_table_comparisons = 0;
+    hash_table_probes = 0;
 }
 
 template <typename Gen>
@@ -225,6 +321,789 @@ py::dict benchmark(
     return res;
 }
 
+py::dict benchmark_batches(
+    const std::vector<int>& queries, 
+    const std::vector<size_t>& ranks, 
+    size_t batch_size
+) {
+    size_t num_keys = ranks.size();
+    size_t num_queries = queries.size();
+
+    f_forest ff(hsf::capacity(1.0, 2.0), hsf::capacity(1.0, 2.0));
+    f_forest batched_ff(hsf::capacity(1.0, 2.0), hsf::capacity(1.0, 2.0));
+    learned_f_forest lff(hsf::capacity(1.0, 1.1), hsf::capacity(10.0, 1.1));
+    learned_f_forest batched_lff(hsf::capacity(1.0, 1.1), hsf::capacity(10.0, 1.1));
+    r_forest rf(hsf::capacity(1.0, 2.0), hsf::capacity(1.0, 2.0));
+    r_forest batched_rf(hsf::capacity(1.0, 2.0), hsf::capacity(1.0, 2.0));
+    for (int key = 0; key < num_keys; key++) {
+        ff.insert(key);
+        batched_ff.insert(key);
+        lff.insert(key, ranks[key]);
+        batched_lff.insert(key, ranks[key]);
+        rf.insert(key);
+        batched_rf.insert(key);
+    }
+
+    py::dict comparisons;
+    py::dict compactions;
+
+    reset_comparisons();
+    for (const auto& query : queries) {
+        auto it1 = ff.find(query);
+        assert(it1 != ff.end() && it1->first == query);
+
+        auto it2 = lff.find(query, ranks[query]);
+        assert(it2 != lff.end() && it2->first == query);
+
+        auto it3 = rf.find(query);
+        assert(it3 != rf.end() && it3->first == query);
+    }
+
+    comparisons["f_forest"] = double(f_forest_comparisons) / num_queries;
+    comparisons["learned_f_forest"] = double(learned_f_forest_comparisons) / num_queries;
+    comparisons["r_forest"] = double(r_forest_comparisons) / num_queries;
+
+    reset_comparisons();
+    for (size_t start = 0; start < num_queries; start += batch_size) {
+        std::vector<int> batch(queries.begin() + start, queries.begin() + std::min(num_queries, start + batch_size));
+        std::vector<size_t> batch_ranks;
+        for (const auto& query : batch) {
+            batch_ranks.push_back(ranks[query]);
+        }
+
+        auto its1 = batched_ff.find_batch(batch);
+        auto its2 = batched_lff.find_batch(batch, batch_ranks);
+        auto its3 = batched_rf.find_batch(batch);
+        for (size_t i = 0; i < batch.size(); i++) {
+            assert(its1[i] != batched_ff.end() && its1[i]->first == batch[i]);
+            assert(its2[i] != batched_lff.end() && its2[i]->first == batch[i]);
+            assert(its3[i] != batched_rf.end() && its3[i]->first == batch[i]);
+        }
+    }
+
+    comparisons["batched_f_forest"] = double(f_forest_comparisons) / num_queries;
+    comparisons["batched_learned_f_forest"] = double(learned_f_forest_comparisons) / num_queries;
+    comparisons["batched_r_forest"] = double(r_forest_comparisons) / num_queries;
+
+    compactions["f_forest"] = ff.compactions_;
+    compactions["batched_f_forest"] = batched_ff.compactions_;
+    compactions["r_forest"] = rf.compactions_;
+    compactions["batched_r_forest"] = batched_rf.compactions_;
+
+    py::dict res;
+    res["comparisons"] = comparisons;
+    res["compactions"] = compactions;
+    return res;
+}
+
+template <typename Gen>
+py::dict benchmark_filters(
+    const std::vector<int>& queries, 
+    size_t num_keys, 
+    double miss_rate, 
+    Gen& gen
+) {
+    size_t num_queries = queries.size();
+
+    f_forest ff(hsf::capacity(1.0, 2.0), hsf::capacity(1.0, 2.0));
+    filtered_f_forest filtered_ff(hsf::capacity(1.0, 2.0), hsf::capacity(1.0, 2.0));
+    r_forest rf(hsf::capacity(1.0, 2.0), hsf::capacity(1.0, 2.0));
+    filtered_r_forest filtered_rf(hsf::capacity(1.0, 2.0), hsf::capacity(1.0, 2.0));
+    for (int key = 0; key < num_keys; key++) {
+        ff.insert(key);
+        filtered_ff.insert(key);
+        rf.insert(key);
+        filtered_rf.insert(key);
+    }
+
+    // Misses are shifted past the key range, so they probe every level.
+    std::bernoulli_distribution miss(miss_rate);
+    std::vector<int> lookups;
+    lookups.reserve(num_queries);
+    for (const auto& query : queries) {
+        lookups.push_back(miss(gen) ? int(num_keys) + query : query);
+    }
+
+    reset_comparisons();
+    for (const auto& lookup : lookups) {
+        bool present = lookup < num_keys;
+        auto it1 = ff.find(lookup);
+        assert((it1 != ff.end()) == present);
+
+        auto it2 = filtered_ff.find(lookup);
+        assert((it2 != filtered_ff.end()) == present);
+
+        auto it3 = rf.find(lookup);
+        assert((it3 != rf.end()) == present);
+
+        auto it4 = filtered_rf.find(lookup);
+        assert((it4 != filtered_rf.end()) == present);
+    }
+
+    py::dict res;
+    res["f_forest"] = double(f_forest_comparisons) / num_queries;
+    res["filtered_f_forest"] = double(filtered_f_forest_comparisons) / num_queries;
+    res["r_forest"] = double(r_forest_comparisons) / num_queries;
+    res["filtered_r_forest"] = double(filtered_r_forest_comparisons) / num_queries;
+    return res;
+}
+
+template <typename Find>
+double queries_per_second(const std::vector<int>& queries, size_t num_threads, Find find) {
+    std::vector<std::thread> threads;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t t = 0; t < num_threads; t++) {
+        threads.emplace_back([&, t]() {
+            for (size_t i = t; i < queries.size(); i += num_threads) {
+                find(queries[i]);
+            }
+        });
+    }
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return queries.size() / elapsed.count();
+}
+
+py::dict benchmark_threads(
+    const std::vector<int>& queries, 
+    const std::vector<size_t>& ranks, 
+    size_t max_threads
+) {
+    size_t num_keys = ranks.size();
+    py::dict res;
+
+    std::vector<size_t> thread_counts;
+    for (size_t threads = 1; threads < max_threads; threads *= 2) {
+        thread_counts.push_back(threads);
+    }
+    thread_counts.push_back(max_threads);
+    res["threads"] = thread_counts;
+
+    std::vector<double> locked_ff_throughput;
+    std::vector<double> ff_throughput;
+    std::vector<double> lff_throughput;
+    std::vector<double> rf_throughput;
+    std::vector<double> epoch_ff_throughput;
+    std::vector<double> epoch_lff_throughput;
+    for (size_t threads : thread_counts) {
+        locked_f_forest locked_ff(hsf::capacity(1.0, 2.0), hsf::capacity(1.0, 2.0));
+        concurrent_f_forest ff(hsf::capacity(1.0, 2.0), hsf::capacity(1.0, 2.0));
+        concurrent_learned_f_forest lff(hsf::capacity(1.0, 1.1), hsf::capacity(10.0, 1.1));
+        concurrent_r_forest rf(hsf::capacity(1.0, 2.0), hsf::capacity(1.0, 2.0));
+        epoch_f_forest epoch_ff(hsf::capacity(1.0, 2.0), hsf::capacity(1.0, 2.0));
+        epoch_learned_f_forest epoch_lff(hsf::capacity(1.0, 1.1), hsf::capacity(10.0, 1.1));
+        for (int key = 0; key < num_keys; key++) {
+            locked_ff.insert(key);
+            ff.insert(key);
+            lff.insert(key, ranks[key]);
+            rf.insert(key);
+            epoch_ff.insert(key);
+            epoch_lff.insert(key, ranks[key]);
+        }
+
+        std::mutex mutex;
+        locked_ff_throughput.push_back(queries_per_second(queries, threads, [&](int query) {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = locked_ff.find(query);
+            assert(it != locked_ff.end());
+        }));
+
+        ff_throughput.push_back(queries_per_second(queries, threads, [&](int query) {
+            auto it = ff.find(query);
+            assert(it != ff.end());
+        }));
+
+        lff_throughput.push_back(queries_per_second(queries, threads, [&](int query) {
+            auto it = lff.find(query, ranks[query]);
+            assert(it != lff.end());
+        }));
+
+        rf_throughput.push_back(queries_per_second(queries, threads, [&](int query) {
+            auto it = rf.find(query);
+            assert(it != rf.end());
+        }));
+
+        epoch_ff_throughput.push_back(queries_per_second(queries, threads, [&](int query) {
+            auto it = epoch_ff.find(query);
+            assert(it != epoch_ff.end());
+        }));
+
+        epoch_lff_throughput.push_back(queries_per_second(queries, threads, [&](int query) {
+            auto it = epoch_lff.find(query, ranks[query]);
+            assert(it != epoch_lff.end());
+        }));
+    }
+
+    res["locked_f_forest"] = locked_ff_throughput;
+    res["f_forest"] = ff_throughput;
+    res["learned_f_forest"] = lff_throughput;
+    res["r_forest"] = rf_throughput;
+    res["epoch_f_forest"] = epoch_ff_throughput;
+    res["epoch_learned_f_forest"] = epoch_lff_throughput;
+    return res;
+}
+
+// Inserts per second of try_emplace on concurrent forests already holding
+// `num_keys` keys, in as many levels as they take, for every thread count in
+// powers of two up to `max_threads`. Each of `num_inserts` new keys is tried
+// by every thread, with frequency (or rank) 1 + key % 64 so that new keys
+// enter levels above the bottom, and must be inserted exactly once.
+py::dict benchmark_try_emplace(
+    size_t num_keys, 
+    size_t num_inserts, 
+    size_t max_threads
+) {
+    py::dict res;
+
+    std::vector<size_t> thread_counts;
+    for (size_t threads = 1; threads < max_threads; threads *= 2) {
+        thread_counts.push_back(threads);
+    }
+    thread_counts.push_back(max_threads);
+    res["threads"] = thread_counts;
+
+    std::vector<int> inserts;
+    for (size_t i = 0; i < num_inserts; i++) {
+        inserts.push_back(int(num_keys + i));
+    }
+
+    std::vector<double> ff_throughput;
+    std::vector<double> lff_throughput;
+    std::vector<double> rf_throughput;
+    for (size_t threads : thread_counts) {
+        concurrent_f_forest ff(hsf::capacity(1.0, 2.0), hsf::capacity(1.0, 2.0));
+        concurrent_learned_f_forest lff(hsf::capacity(1.0, 1.1), hsf::capacity(10.0, 1.1));
+        concurrent_r_forest rf(hsf::capacity(1.0, 2.0), hsf::capacity(1.0, 2.0));
+        for (int key = 0; key < num_keys; key++) {
+            ff.insert(key, key % 64);
+            lff.insert(key, key);
+            rf.insert(key);
+        }
+
+        std::atomic<size_t> ff_inserted{0};
+        std::atomic<size_t> lff_inserted{0};
+        std::atomic<size_t> rf_inserted{0};
+        std::vector<int> tries;
+        for (int key : inserts) {
+            tries.insert(tries.end(), threads, key);
+        }
+
+        ff_throughput.push_back(queries_per_second(tries, threads, [&](int key) {
+            ff_inserted += ff.try_emplace(key, 1 + key % 64).second;
+        }) / threads);
+        assert(ff_inserted == num_inserts && ff.size() == num_keys + num_inserts);
+
+        lff_throughput.push_back(queries_per_second(tries, threads, [&](int key) {
+            lff_inserted += lff.try_emplace(key, 1 + key % 64).second;
+        }) / threads);
+        assert(lff_inserted == num_inserts && lff.size() == num_keys + num_inserts);
+
+        rf_throughput.push_back(queries_per_second(tries, threads, [&](int key) {
+            rf_inserted += rf.try_emplace(key).second;
+        }) / threads);
+        assert(rf_inserted == num_inserts && rf.size() == num_keys + num_inserts);
+    }
+
+    res["f_forest"] = ff_throughput;
+    res["learned_f_forest"] = lff_throughput;
+    res["r_forest"] = rf_throughput;
+    return res;
+}
+
+// Queries per second of `find_batch(batch)` over consecutive batches of
+// `batch_size` queries, split across threads.
+template <typename FindBatch>
+double batched_queries_per_second(const std::vector<int>& queries, size_t num_threads, size_t batch_size, FindBatch find_batch) {
+    std::vector<std::thread> threads;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t t = 0; t < num_threads; t++) {
+        threads.emplace_back([&, t]() {
+            for (size_t i = t * batch_size; i < queries.size(); i += num_threads * batch_size) {
+                std::vector<int> batch(queries.begin() + i, queries.begin() + std::min(queries.size(), i + batch_size));
+                find_batch(batch);
+            }
+        });
+    }
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return queries.size() / elapsed.count();
+}
+
+// Throughput of sharded forests for every number of shards and client
+// threads in powers of two up to the given maxima, indexed [shards][threads].
+// Clients look up `batch_size` queries at a time, or one with batch_size 1.
+// The learned R-forest is given ranks as its predicted accesses.
+py::dict benchmark_sharding(
+    const std::vector<int>& queries, 
+    const std::vector<size_t>& ranks, 
+    size_t max_shards, 
+    size_t max_threads, 
+    size_t batch_size
+) {
+    size_t num_keys = ranks.size();
+    py::dict res;
+
+    auto powers_of_two = [](size_t max) {
+        std::vector<size_t> counts;
+        for (size_t count = 1; count < max; count *= 2) {
+            counts.push_back(count);
+        }
+        counts.push_back(max);
+        return counts;
+    };
+    std::vector<size_t> shard_counts = powers_of_two(max_shards);
+    std::vector<size_t> thread_counts = powers_of_two(max_threads);
+    res["shards"] = shard_counts;
+    res["threads"] = thread_counts;
+
+    std::vector<std::vector<double>> ff_throughput;
+    std::vector<std::vector<double>> lff_throughput;
+    std::vector<std::vector<double>> rf_throughput;
+    std::vector<std::vector<double>> lrf_throughput;
+    for (size_t shards : shard_counts) {
+        sharded_f_forest ff(shards, hsf::capacity(1.0, 2.0), hsf::capacity(1.0, 2.0));
+        sharded_learned_f_forest lff(shards, hsf::capacity(1.0, 1.1), hsf::capacity(10.0, 1.1));
+        sharded_r_forest rf(shards, hsf::capacity(1.0, 2.0), hsf::capacity(1.0, 2.0));
+        sharded_learned_r_forest lrf(shards, hsf::capacity(1.0, 1.1), hsf::capacity(10.0, 1.1));
+        for (int key = 0; key < num_keys; key++) {
+            ff.insert(key);
+            lff.insert(key, ranks[key]);
+            rf.insert(key);
+            lrf.insert(key, ranks[key]);
+        }
+
+        ff_throughput.emplace_back();
+        lff_throughput.emplace_back();
+        rf_throughput.emplace_back();
+        lrf_throughput.emplace_back();
+        for (size_t threads : thread_counts) {
+            ff_throughput.back().push_back(batched_queries_per_second(queries, threads, batch_size, [&](const std::vector<int>& batch) {
+                if (batch_size == 1) {
+                    bool found = ff.find(batch[0]);
+                    assert(found);
+                } else {
+                    auto found = ff.find_batch(batch);
+                    assert(std::find(found.begin(), found.end(), false) == found.end());
+                }
+            }));
+
+            lff_throughput.back().push_back(batched_queries_per_second(queries, threads, batch_size, [&](const std::vector<int>& batch) {
+                std::vector<size_t> batch_ranks;
+                for (const auto& query : batch) {
+                    batch_ranks.push_back(ranks[query]);
+                }
+
+                if (batch_size == 1) {
+                    bool found = lff.find(batch[0], batch_ranks[0]);
+                    assert(found);
+                } else {
+                    auto found = lff.find_batch(batch, batch_ranks);
+                    assert(std::find(found.begin(), found.end(), false) == found.end());
+                }
+            }));
+
+            rf_throughput.back().push_back(batched_queries_per_second(queries, threads, batch_size, [&](const std::vector<int>& batch) {
+                if (batch_size == 1) {
+                    bool found = rf.find(batch[0]);
+                    assert(found);
+                } else {
+                    auto found = rf.find_batch(batch);
+                    assert(std::find(found.begin(), found.end(), false) == found.end());
+                }
+            }));
+
+            lrf_throughput.back().push_back(batched_queries_per_second(queries, threads, batch_size, [&](const std::vector<int>& batch) {
+                std::vector<size_t> batch_ranks;
+                for (const auto& query : batch) {
+                    batch_ranks.push_back(ranks[query]);
+                }
+
+                if (batch_size == 1) {
+                    lrf.find(batch[0], batch_ranks[0], batch_ranks[0]);
+                } else {
+                    lrf.find_batch(batch, batch_ranks, batch_ranks);
+                }
+            }));
+        }
+    }
+
+    res["f_forest"] = ff_throughput;
+    res["learned_f_forest"] = lff_throughput;
+    res["r_forest"] = rf_throughput;
+    res["learned_r_forest"] = lrf_throughput;
+    return res;
+}
+
+// Sorted latencies in microseconds of `op(i)` for every query index i,
+// split across threads.
+template <typename Op>
+std::vector<double> operation_latencies(size_t num_queries, size_t num_threads, Op op) {
+    std::vector<std::vector<double>> latencies(num_threads);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < num_threads; t++) {
+        threads.emplace_back([&, t]() {
+            for (size_t i = t; i < num_queries; i += num_threads) {
+                auto start = std::chrono::steady_clock::now();
+                op(i);
+                std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+                latencies[t].push_back(elapsed.count());
+            }
+        });
+    }
+
+    std::vector<double> all;
+    for (size_t t = 0; t < num_threads; t++) {
+        threads[t].join();
+        all.insert(all.end(), latencies[t].begin(), latencies[t].end());
+    }
+    std::sort(all.begin(), all.end());
+    return all;
+}
+
+py::dict latency_percentiles(const std::vector<double>& latencies) {
+    auto percentile = [&](double p) {
+        return latencies[size_t(p / 100 * (latencies.size() - 1))];
+    };
+
+    py::dict res;
+    res["p50"] = percentile(50);
+    res["p99"] = percentile(99);
+    res["p99.9"] = percentile(99.9);
+    res["max"] = latencies.back();
+    return res;
+}
+
+// Per-operation latency of concurrent forests whose compactions run inline
+// or on a background thread with the given slack. Every operation inserts a
+// new key and looks up a queried one.
+py::dict benchmark_compaction(
+    const std::vector<int>& queries, 
+    size_t num_keys, 
+    size_t num_threads, 
+    double slack
+) {
+    py::dict res;
+    for (bool background : {false, true}) {
+        concurrent_f_forest ff(hsf::capacity(1.0, 2.0), hsf::capacity(2.0, 2.0));
+        concurrent_r_forest rf(hsf::capacity(1.0, 2.0), hsf::capacity(2.0, 2.0));
+        for (int key = 0; key < num_keys; key++) {
+            ff.insert(key);
+            rf.insert(key);
+        }
+        if (background) {
+            ff.start_compaction(slack);
+            rf.start_compaction(slack);
+        }
+
+        py::dict latencies;
+        latencies["f_forest"] = latency_percentiles(operation_latencies(queries.size(), num_threads, [&](size_t i) {
+            ff.insert(num_keys + i);
+            ff.find(queries[i]);
+        }));
+        latencies["r_forest"] = latency_percentiles(operation_latencies(queries.size(), num_threads, [&](size_t i) {
+            rf.insert(num_keys + i);
+            rf.find(queries[i]);
+        }));
+        res[background ? "background" : "inline"] = latencies;
+    }
+    return res;
+}
+
+// Keys moved between levels by the operation in progress.
+static size_t operation_moves = 0;
+struct move_counter : hsf::null_stats {
+    void move(size_t, size_t) const { operation_moves++; }
+};
+struct counted_moves : hsf::single_threaded {
+    using stats_type = move_counter;
+};
+using budgeted_f_forest = hsf::basic_frequency_forest<counted_moves, hsf::capacity, std::map, int>;
+using budgeted_r_forest = hsf::basic_recency_forest<counted_moves, hsf::capacity, std::map, int>;
+
+// Sorted keys moved by `op(i)` for every query index i.
+template <typename Op>
+std::vector<double> operation_move_counts(size_t num_queries, Op op) {
+    std::vector<double> moves;
+    for (size_t i = 0; i < num_queries; i++) {
+        operation_moves = 0;
+        op(i);
+        moves.push_back(operation_moves);
+    }
+    std::sort(moves.begin(), moves.end());
+    return moves;
+}
+
+// Keys moved per operation by single-threaded forests whose compactions run
+// in full or at most `budget` moves per operation, and their throughput.
+// Every operation inserts a new key and looks up a queried one.
+py::dict benchmark_deamortization(
+    const std::vector<int>& queries, 
+    size_t num_keys, 
+    size_t budget
+) {
+    py::dict res;
+    for (bool deamortized : {false, true}) {
+        budgeted_f_forest ff(hsf::capacity(1.0, 2.0), hsf::capacity(2.0, 2.0));
+        budgeted_r_forest rf(hsf::capacity(1.0, 2.0), hsf::capacity(2.0, 2.0));
+        for (int key = 0; key < num_keys; key++) {
+            ff.insert(key);
+            rf.insert(key);
+        }
+        if (deamortized) {
+            ff.set_move_budget(budget);
+            rf.set_move_budget(budget);
+        }
+
+        py::dict moves;
+        auto start = std::chrono::steady_clock::now();
+        py::dict f_moves = latency_percentiles(operation_move_counts(queries.size(), [&](size_t i) {
+            ff.insert(num_keys + i);
+            ff.find(queries[i]);
+        }));
+        std::chrono::duration<double> f_elapsed = std::chrono::steady_clock::now() - start;
+
+        start = std::chrono::steady_clock::now();
+        py::dict r_moves = latency_percentiles(operation_move_counts(queries.size(), [&](size_t i) {
+            rf.insert(num_keys + i);
+            rf.find(queries[i]);
+        }));
+        std::chrono::duration<double> r_elapsed = std::chrono::steady_clock::now() - start;
+
+        f_moves["throughput"] = queries.size() / f_elapsed.count();
+        r_moves["throughput"] = queries.size() / r_elapsed.count();
+        moves["f_forest"] = f_moves;
+        moves["r_forest"] = r_moves;
+        res[deamortized ? "deamortized" : "amortized"] = moves;
+    }
+    return res;
+}
+
+using tuned_f_forest = hsf::basic_frequency_forest<hsf::with_stats<hsf::single_threaded>, hsf::capacity, std::map, int>;
+using tuned_r_forest = hsf::basic_recency_forest<hsf::with_stats<hsf::single_threaded>, hsf::capacity, std::map, int>;
+
+// Throughput of each phase of a shifting workload, e.g. Zipf queries of
+// alternating skew, with the capacities fixed at capacity(1.0, 2.0) or
+// retuned every `interval` lookups by a capacity_tuner.
+py::dict benchmark_tuning(
+    const std::vector<std::vector<int>>& phases, 
+    size_t num_keys, 
+    size_t interval
+) {
+    py::dict res;
+    for (bool tuned : {false, true}) {
+        tuned_f_forest ff(hsf::capacity(1.0, 2.0), hsf::capacity(1.0, 2.0));
+        tuned_r_forest rf(hsf::capacity(1.0, 2.0), hsf::capacity(1.0, 2.0));
+        for (int key = 0; key < num_keys; key++) {
+            ff.insert(key);
+            rf.insert(key);
+        }
+
+        hsf::capacity_tuner f_tuner;
+        hsf::capacity_tuner r_tuner;
+        size_t f_lookups = 0;
+        size_t r_lookups = 0;
+        std::vector<double> f_throughput;
+        std::vector<double> r_throughput;
+        for (const auto& queries : phases) {
+            f_throughput.push_back(queries_per_second(queries, 1, [&](int query) {
+                ff.find(query);
+                if (tuned && ++f_lookups % interval == 0) {
+                    f_tuner.retune(ff);
+                }
+            }));
+            r_throughput.push_back(queries_per_second(queries, 1, [&](int query) {
+                rf.find(query);
+                if (tuned && ++r_lookups % interval == 0) {
+                    r_tuner.retune(rf);
+                }
+            }));
+        }
+
+        py::dict throughput;
+        throughput["f_forest"] = f_throughput;
+        throughput["r_forest"] = r_throughput;
+        res[tuned ? "tuned" : "static"] = throughput;
+    }
+    return res;
+}
+
+py::dict benchmark_containers(
+    const std::vector<int>& queries, 
+    const std::vector<size_t>& ranks
+) {
+    size_t num_keys = ranks.size();
+
+    map_f_forest ff(hsf::capacity(1.0, 2.0), hsf::capacity(1.0, 2.0));
+    flat_f_forest flat_ff(hsf::capacity(1.0, 2.0), hsf::capacity(1.0, 2.0));
+    map_learned_f_forest lff(hsf::capacity(1.0, 1.1), hsf::capacity(10.0, 1.1));
+    flat_learned_f_forest flat_lff(hsf::capacity(1.0, 1.1), hsf::capacity(10.0, 1.1));
+    map_r_forest rf(hsf::capacity(1.0, 2.0), hsf::capacity(1.0, 2.0));
+    flat_r_forest flat_rf(hsf::capacity(1.0, 2.0), hsf::capacity(1.0, 2.0));
+    btree_f_forest btree_ff(hsf::capacity(1.0, 2.0), hsf::capacity(1.0, 2.0));
+    btree_learned_f_forest btree_lff(hsf::capacity(1.0, 1.1), hsf::capacity(10.0, 1.1));
+    btree_r_forest btree_rf(hsf::capacity(1.0, 2.0), hsf::capacity(1.0, 2.0));
+    for (int key = 0; key < num_keys; key++) {
+        ff.insert(key);
+        flat_ff.insert(key);
+        btree_ff.insert(key);
+        lff.insert(key, ranks[key]);
+        flat_lff.insert(key, ranks[key]);
+        btree_lff.insert(key, ranks[key]);
+        rf.insert(key);
+        flat_rf.insert(key);
+        btree_rf.insert(key);
+    }
+
+    py::dict res;
+    res["f_forest"] = queries_per_second(queries, 1, [&](int query) { ff.find(query); });
+    res["flat_f_forest"] = queries_per_second(queries, 1, [&](int query) { flat_ff.find(query); });
+    res["btree_f_forest"] = queries_per_second(queries, 1, [&](int query) { btree_ff.find(query); });
+    res["learned_f_forest"] = queries_per_second(queries, 1, [&](int query) { lff.find(query, ranks[query]); });
+    res["flat_learned_f_forest"] = queries_per_second(queries, 1, [&](int query) { flat_lff.find(query, ranks[query]); });
+    res["btree_learned_f_forest"] = queries_per_second(queries, 1, [&](int query) { btree_lff.find(query, ranks[query]); });
+    res["r_forest"] = queries_per_second(queries, 1, [&](int query) { rf.find(query); });
+    res["flat_r_forest"] = queries_per_second(queries, 1, [&](int query) { flat_rf.find(query); });
+    res["btree_r_forest"] = queries_per_second(queries, 1, [&](int query) { btree_rf.find(query); });
+    return res;
+}
+
+// Tree and hash-table levels against a single flat hash table. Comparisons
+// count key compares or equality checks; probes count hash computations,
+// i.e. levels probed plus rehashing on moves.
+py::dict benchmark_hashing(
+    const std::vector<int>& queries, 
+    const std::vector<size_t>& ranks
+) {
+    size_t num_keys = ranks.size();
+    size_t num_queries = queries.size();
+
+    {
+        f_forest ff(hsf::capacity(1.0, 2.0), hsf::capacity(1.0, 2.0));
+        learned_f_forest lff(hsf::capacity(1.0, 1.1), hsf::capacity(10.0, 1.1));
+        r_forest rf(hsf::capacity(1.0, 2.0), hsf::capacity(1.0, 2.0));
+        hashed_f_forest hashed_ff(hsf::capacity(1.0, 2.0), hsf::capacity(1.0, 2.0));
+        hashed_learned_f_forest hashed_lff(hsf::capacity(1.0, 1.1), hsf::capacity(10.0, 1.1));
+        hashed_r_forest hashed_rf(hsf::capacity(1.0, 2.0), hsf::capacity(1.0, 2.0));
+        counted_hash_table table;
+        for (int key = 0; key < num_keys; key++) {
+            ff.insert(key);
+            lff.insert(key, ranks[key]);
+            rf.insert(key);
+            hashed_ff.insert(key);
+            hashed_lff.insert(key, ranks[key]);
+            hashed_rf.insert(key);
+            table.insert({key, 0});
+        }
+
+        reset_comparisons();
+        for (const auto& query : queries) {
+            ff.find(query);
+            lff.find(query, ranks[query]);
+            rf.find(query);
+            hashed_ff.find(query);
+            hashed_lff.find(query, ranks[query]);
+            hashed_rf.find(query);
+            table.find(query);
+        }
+    }
+
+    py::dict comparisons;
+    comparisons["f_forest"] = double(f_forest_comparisons) / num_queries;
+    comparisons["learned_f_forest"] = double(learned_f_forest_comparisons) / num_queries;
+    comparisons["r_forest"] = double(r_forest_comparisons) / num_queries;
+    comparisons["hash_f_forest"] = double(hashed_f_forest_comparisons) / num_queries;
+    comparisons["hash_learned_f_forest"] = double(hashed_learned_f_forest_comparisons) / num_queries;
+    comparisons["hash_r_forest"] = double(hashed_r_forest_comparisons) / num_queries;
+    comparisons["hash_table"] = double(hash_table_comparisons) / num_queries;
+
+    py::dict probes;
+    probes["hash_f_forest"] = double(hashed_f_forest_probes) / num_queries;
+    probes["hash_learned_f_forest"] = double(hashed_learned_f_forest_probes) / num_queries;
+    probes["hash_r_forest"] = double(hashed_r_forest_probes) / num_queries;
+    probes["hash_table"] = double(hash_table_probes) / num_queries;
+
+    map_f_forest ff(hsf::capacity(1.0, 2.0), hsf::capacity(1.0, 2.0));
+    map_learned_f_forest lff(hsf::capacity(1.0, 1.1), hsf::capacity(10.0, 1.1));
+    map_r_forest rf(hsf::capacity(1.0, 2.0), hsf::capacity(1.0, 2.0));
+    hash_f_forest hash_ff(hsf::capacity(1.0, 2.0), hsf::capacity(1.0, 2.0));
+    hash_learned_f_forest hash_lff(hsf::capacity(1.0, 1.1), hsf::capacity(10.0, 1.1));
+    hash_r_forest hash_rf(hsf::capacity(1.0, 2.0), hsf::capacity(1.0, 2.0));
+    hsf::hash_table<int, char> table;
+    std::unordered_set<int> unordered;
+    for (int key = 0; key < num_keys; key++) {
+        ff.insert(key);
+        lff.insert(key, ranks[key]);
+        rf.insert(key);
+        hash_ff.insert(key);
+        hash_lff.insert(key, ranks[key]);
+        hash_rf.insert(key);
+        table.insert({key, 0});
+        unordered.insert(key);
+    }
+
+    py::dict throughput;
+    throughput["f_forest"] = queries_per_second(queries, 1, [&](int query) { ff.find(query); });
+    throughput["learned_f_forest"] = queries_per_second(queries, 1, [&](int query) { lff.find(query, ranks[query]); });
+    throughput["r_forest"] = queries_per_second(queries, 1, [&](int query) { rf.find(query); });
+    throughput["hash_f_forest"] = queries_per_second(queries, 1, [&](int query) { hash_ff.find(query); });
+    throughput["hash_learned_f_forest"] = queries_per_second(queries, 1, [&](int query) { hash_lff.find(query, ranks[query]); });
+    throughput["hash_r_forest"] = queries_per_second(queries, 1, [&](int query) { hash_rf.find(query); });
+    throughput["hash_table"] = queries_per_second(queries, 1, [&](int query) { table.find(query); });
+    throughput["unordered_set"] = queries_per_second(queries, 1, [&](int query) { unordered.find(query); });
+
+    py::dict res;
+    res["comparisons"] = comparisons;
+    res["probes"] = probes;
+    res["throughput"] = throughput;
+    return res;
+}
+
+// Growable forests against fixed-depth forests with the same capacities.
+py::dict benchmark_fixed_depth(
+    const std::vector<int>& queries, 
+    const std::vector<size_t>& ranks
+) {
+    size_t num_keys = ranks.size();
+
+    map_f_forest ff(hsf::capacity(1.0, 2.0), hsf::capacity(1.0, 2.0));
+    flat_f_forest flat_ff(hsf::capacity(1.0, 2.0), hsf::capacity(1.0, 2.0));
+    map_learned_f_forest lff(hsf::capacity(1.0, 2.0), hsf::capacity(1.0, 2.0));
+    map_r_forest rf(hsf::capacity(1.0, 2.0), hsf::capacity(1.0, 2.0));
+    fixed_f_forest fixed_ff(hsf::capacity(1.0, 2.0), hsf::capacity(1.0, 2.0));
+    fixed_flat_f_forest fixed_flat_ff(hsf::capacity(1.0, 2.0), hsf::capacity(1.0, 2.0));
+    fixed_learned_f_forest fixed_lff(hsf::capacity(1.0, 2.0), hsf::capacity(1.0, 2.0));
+    fixed_r_forest fixed_rf(hsf::capacity(1.0, 2.0), hsf::capacity(1.0, 2.0));
+    for (int key = 0; key < num_keys; key++) {
+        ff.insert(key);
+        flat_ff.insert(key);
+        lff.insert(key, ranks[key]);
+        rf.insert(key);
+        fixed_ff.insert(key);
+        fixed_flat_ff.insert(key);
+        fixed_lff.insert(key, ranks[key]);
+        fixed_rf.insert(key);
+    }
+
+    py::dict res;
+    res["f_forest"] = queries_per_second(queries, 1, [&](int query) { ff.find(query); });
+    res["flat_f_forest"] = queries_per_second(queries, 1, [&](int query) { flat_ff.find(query); });
+    res["learned_f_forest"] = queries_per_second(queries, 1, [&](int query) { lff.find(query, ranks[query]); });
+    res["r_forest"] = queries_per_second(queries, 1, [&](int query) { rf.find(query); });
+    res["fixed_f_forest"] = queries_per_second(queries, 1, [&](int query) { fixed_ff.find(query); });
+    res["fixed_flat_f_forest"] = queries_per_second(queries, 1, [&](int query) { fixed_flat_ff.find(query); });
+    res["fixed_learned_f_forest"] = queries_per_second(queries, 1, [&](int query) { fixed_lff.find(query, ranks[query]); });
+    res["fixed_r_forest"] = queries_per_second(queries, 1, [&](int query) { fixed_rf.find(query); });
+    return res;
+}
+
 PYBIND11_MODULE(benchmark_module, m) {
     m.doc() = "Benchmarking module for search forests";
 
@@ -258,4 +1137,60 @@ PYBIND11_MODULE(benchmark_module, m) {
           &benchmark<std::mt19937>,
           "benchmark(queries: List[int], frequencies: List[int], ranks: List[int], accesses: List[List[int]], gen: RandomEngine, sketch: bool) -> Dict[str, Dict[str, float]]",
           py::arg("queries"), py::arg("frequencies"), py::arg("ranks"), py::arg("accesses"), py::arg("gen"), py::arg("sketch") = false);
+
+    m.def("benchmark_batches",
+          &benchmark_batches,
+          "benchmark_batches(queries: List[int], ranks: List[int], batch_size: int) -> Dict[str, Dict[str, float]]",
+          py::arg("queries"), py::arg("ranks"), py::arg("batch_size"));
+
+    m.def("benchmark_filters",
+          &benchmark_filters<std::mt19937>,
+          "benchmark_filters(queries: List[int], num_keys: int, miss_rate: float, gen: RandomEngine) -> Dict[str, float]",
+          py::arg("queries"), py::arg("num_keys"), py::arg("miss_rate"), py::arg("gen"));
+
+    m.def("benchmark_containers",
+          &benchmark_containers,
+          "benchmark_containers(queries: List[int], ranks: List[int]) -> Dict[str, float]",
+          py::arg("queries"), py::arg("ranks"));
+
+    m.def("benchmark_hashing",
+          &benchmark_hashing,
+          "benchmark_hashing(queries: List[int], ranks: List[int]) -> Dict[str, Dict[str, float]]",
+          py::arg("queries"), py::arg("ranks"));
+
+    m.def("benchmark_fixed_depth",
+          &benchmark_fixed_depth,
+          "benchmark_fixed_depth(queries: List[int], ranks: List[int]) -> Dict[str, float]",
+          py::arg("queries"), py::arg("ranks"));
+
+    m.def("benchmark_compaction",
+          &benchmark_compaction,
+          "benchmark_compaction(queries: List[int], num_keys: int, num_threads: int, slack: float) -> Dict[str, Dict[str, Dict[str, float]]]",
+          py::arg("queries"), py::arg("num_keys"), py::arg("num_threads") = 1, py::arg("slack") = 1.0);
+
+    m.def("benchmark_deamortization",
+          &benchmark_deamortization,
+          "benchmark_deamortization(queries: List[int], num_keys: int, budget: int) -> Dict[str, Dict[str, Dict[str, float]]]",
+          py::arg("queries"), py::arg("num_keys"), py::arg("budget") = 16);
+
+    m.def("benchmark_tuning",
+          &benchmark_tuning,
+          "benchmark_tuning(phases: List[List[int]], num_keys: int, interval: int) -> Dict[str, Dict[str, List[float]]]",
+          py::arg("phases"), py::arg("num_keys"), py::arg("interval") = 50000);
+
+    m.def("benchmark_threads",
+          &benchmark_threads,
+          "benchmark_threads(queries: List[int], ranks: List[int], max_threads: int) -> Dict[str, List[float]]",
+          py::arg("queries"), py::arg("ranks"), py::arg("max_threads") = std::thread::hardware_concurrency());
+
+    m.def("benchmark_try_emplace",
+          &benchmark_try_emplace,
+          "benchmark_try_emplace(num_keys: int, num_inserts: int, max_threads: int) -> Dict[str, List[float]]",
+          py::arg("num_keys"), py::arg("num_inserts"), py::arg("max_threads") = std::thread::hardware_concurrency());
+
+    m.def("benchmark_sharding",
+          &benchmark_sharding,
+          "benchmark_sharding(queries: List[int], ranks: List[int], max_shards: int, max_threads: int, batch_size: int) -> Dict[str, List[List[float]]]",
+          py::arg("queries"), py::arg("ranks"), py::arg("max_shards") = std::thread::hardware_concurrency(), 
+          py::arg("max_threads") = std::thread::hardware_concurrency(), py::arg("batch_size") = 64);
 }
\ No newline at end of file
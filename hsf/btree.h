@@ -0,0 +1,605 @@
+#ifndef HSF_BTREE_H
+#define HSF_BTREE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+
+namespace hsf {
+
+// B+tree level container with the interface of std::map, for the large
+// bottom levels of a forest. Node keys span two cache lines and leaves keep
+// keys apart from metadata, so a lookup only touches key lines; entries cost
+// about 20 bytes with small metadata instead of a 48-byte std::map node.
+//
+// Since keys and metadata are stored apart, iterators yield a proxy with
+// `first` and `second` references instead of a std::pair. Inserts and erases
+// invalidate iterators.
+template <typename Key, typename T, typename Compare = std::less<Key>>
+class btree {
+    struct node;
+    struct leaf_node;
+    struct inner_node;
+
+    template <bool Const>
+    class basic_iterator;
+
+public:
+    using key_type = Key;
+    using mapped_type = T;
+    using value_type = std::pair<Key, T>;
+    using size_type = size_t;
+    using key_compare = Compare;
+    using iterator = basic_iterator<false>;
+    using const_iterator = basic_iterator<true>;
+
+    static constexpr bool stable_iterators = false;
+    static constexpr size_type node_slots = std::max<size_type>(8, 128 / sizeof(Key));
+
+    btree() : root_(nullptr), head_(nullptr), tail_(nullptr), size_(0) {}
+
+    btree(const btree& other) : btree() {
+        for (const auto& [key, value] : other) {
+            emplace_hint(end(), key, value);
+        }
+    }
+
+    btree(btree&& other) noexcept : btree() {
+        swap(other);
+    }
+
+    btree& operator=(btree other) noexcept {
+        swap(other);
+        return *this;
+    }
+
+    ~btree() {
+        destroy(root_);
+    }
+
+    void swap(btree& other) noexcept {
+        std::swap(root_, other.root_);
+        std::swap(head_, other.head_);
+        std::swap(tail_, other.tail_);
+        std::swap(size_, other.size_);
+        std::swap(compare_, other.compare_);
+    }
+
+    iterator begin() {
+        return iterator(this, head_, 0);
+    }
+
+    iterator end() {
+        return iterator(this, nullptr, 0);
+    }
+
+    const_iterator begin() const {
+        return const_iterator(this, head_, 0);
+    }
+
+    const_iterator end() const {
+        return const_iterator(this, nullptr, 0);
+    }
+
+    size_type size() const {
+        return size_;
+    }
+
+    bool empty() const {
+        return size_ == 0;
+    }
+
+    key_compare key_comp() const {
+        return compare_;
+    }
+
+    iterator lower_bound(const key_type& key) {
+        return find_lower(key);
+    }
+
+    const_iterator lower_bound(const key_type& key) const {
+        return const_cast<btree*>(this)->lower_bound(key);
+    }
+
+    iterator find(const key_type& key) {
+        return find_equal(key);
+    }
+
+    const_iterator find(const key_type& key) const {
+        return const_cast<btree*>(this)->find(key);
+    }
+
+    // Lookups by any type comparable with keys, given a transparent Compare.
+    template <typename K, typename C = Compare, typename = typename C::is_transparent>
+    iterator lower_bound(const K& key) {
+        return find_lower(key);
+    }
+
+    template <typename K, typename C = Compare, typename = typename C::is_transparent>
+    iterator find(const K& key) {
+        return find_equal(key);
+    }
+
+    std::pair<iterator, bool> insert(const value_type& value) {
+        return insert_unique(value.first, value.second);
+    }
+
+    std::pair<iterator, bool> insert(value_type&& value) {
+        return insert_unique(std::move(value.first), std::move(value.second));
+    }
+
+    // Appending in key order through end() skips the descent, as in std::map.
+    template <typename... Params>
+    iterator emplace_hint(const_iterator hint, Params&&... params) {
+        value_type value(std::forward<Params>(params)...);
+        if (hint == end() && tail_ != nullptr && compare_(tail_->keys[tail_->count - 1], value.first)) {
+            return insert_at(tail_, tail_->count, std::move(value.first), std::move(value.second));
+        }
+        return insert(std::move(value)).first;
+    }
+
+    iterator erase(const_iterator it) {
+        leaf_node* leaf = const_cast<leaf_node*>(it.leaf_);
+        size_type index = it.index_;
+        std::move(leaf->keys + index + 1, leaf->keys + leaf->count, leaf->keys + index);
+        std::move(leaf->values + index + 1, leaf->values + leaf->count, leaf->values + index);
+        leaf->count--;
+        size_--;
+
+        // Releases the vacated slot now, e.g. a payload or string buffer,
+        // rather than when it is next overwritten or its node is freed.
+        leaf->keys[leaf->count] = key_type();
+        leaf->values[leaf->count] = mapped_type();
+
+        if (leaf->count >= min_slots || leaf == root_) {
+            if (leaf->count == 0) {
+                clear();
+                return end();
+            }
+            return normalize(leaf, index);
+        }
+
+        auto next = normalize(leaf, index);
+        if (next == end()) {
+            rebalance(leaf);
+            return end();
+        }
+
+        key_type next_key = next->first;
+        rebalance(leaf);
+        return lower_bound(next_key);
+    }
+
+    size_type erase(const key_type& key) {
+        auto it = find(key);
+        if (it == end()) {
+            return 0;
+        }
+        erase(it);
+        return 1;
+    }
+
+    void clear() {
+        destroy(root_);
+        root_ = nullptr;
+        head_ = nullptr;
+        tail_ = nullptr;
+        size_ = 0;
+    }
+
+private:
+    static constexpr size_type min_slots = node_slots / 3;
+    static constexpr bool linear_search = std::is_arithmetic_v<Key> && std::is_same_v<Compare, std::less<Key>>;
+
+    struct node {
+        inner_node* parent = nullptr;
+        uint32_t count = 0;
+        bool leaf;
+
+        explicit node(bool leaf) : leaf(leaf) {}
+    };
+
+    struct leaf_node : node {
+        Key keys[node_slots];
+        T values[node_slots];
+        leaf_node* prev = nullptr;
+        leaf_node* next = nullptr;
+
+        leaf_node() : node(true) {}
+    };
+
+    struct inner_node : node {
+        Key keys[node_slots];
+        node* children[node_slots + 1];
+
+        inner_node() : node(false) {}
+    };
+
+    template <bool Const>
+    class basic_iterator {
+        using mapped_reference = std::conditional_t<Const, const T&, T&>;
+
+    public:
+        struct reference {
+            const Key& first;
+            mapped_reference second;
+
+            operator value_type() const {
+                return {first, second};
+            }
+        };
+
+        struct pointer {
+            reference ref;
+
+            const reference* operator->() const {
+                return &ref;
+            }
+        };
+
+        using iterator_category = std::bidirectional_iterator_tag;
+        using value_type = typename btree::value_type;
+        using difference_type = std::ptrdiff_t;
+
+        basic_iterator() : tree_(nullptr), leaf_(nullptr), index_(0) {}
+
+        template <bool Other, typename = std::enable_if_t<Const && !Other>>
+        basic_iterator(const basic_iterator<Other>& other)
+            : tree_(other.tree_), leaf_(other.leaf_), index_(other.index_) {}
+
+        reference operator*() const {
+            return {leaf_->keys[index_], leaf_->values[index_]};
+        }
+
+        pointer operator->() const {
+            return {**this};
+        }
+
+        basic_iterator& operator++() {
+            if (++index_ == leaf_->count) {
+                leaf_ = leaf_->next;
+                index_ = 0;
+            }
+            return *this;
+        }
+
+        basic_iterator operator++(int) {
+            auto it = *this;
+            ++*this;
+            return it;
+        }
+
+        basic_iterator& operator--() {
+            if (index_ == 0) {
+                leaf_ = leaf_ == nullptr ? tree_->tail_ : leaf_->prev;
+                index_ = leaf_->count;
+            }
+            index_--;
+            return *this;
+        }
+
+        basic_iterator operator--(int) {
+            auto it = *this;
+            --*this;
+            return it;
+        }
+
+        bool operator==(const basic_iterator& other) const {
+            return leaf_ == other.leaf_ && index_ == other.index_;
+        }
+
+        bool operator!=(const basic_iterator& other) const {
+            return !(*this == other);
+        }
+
+    private:
+        friend class btree;
+        template <bool>
+        friend class basic_iterator;
+
+        using tree_type = std::conditional_t<Const, const btree, btree>;
+        using leaf_type = std::conditional_t<Const, const leaf_node, leaf_node>;
+
+        tree_type* tree_;
+        leaf_type* leaf_;
+        size_type index_;
+
+        basic_iterator(tree_type* tree, leaf_type* leaf, size_type index)
+            : tree_(tree), leaf_(leaf), index_(index) {}
+    };
+
+    node* root_;
+    leaf_node* head_;
+    leaf_node* tail_;
+    size_type size_;
+    Compare compare_;
+
+    static void destroy(node* target) {
+        if (target == nullptr) {
+            return;
+        }
+
+        if (target->leaf) {
+            delete static_cast<leaf_node*>(target);
+        } else {
+            auto* inner = static_cast<inner_node*>(target);
+            for (size_type i = 0; i <= inner->count; i++) {
+                destroy(inner->children[i]);
+            }
+            delete inner;
+        }
+    }
+
+    template <typename K>
+    iterator find_lower(const K& key) {
+        if (root_ == nullptr) {
+            return end();
+        }
+
+        leaf_node* leaf = descend(key);
+        return normalize(leaf, lower_index(leaf->keys, leaf->count, key));
+    }
+
+    template <typename K>
+    iterator find_equal(const K& key) {
+        auto it = find_lower(key);
+        if (it == end() || compare_(key, it->first)) {
+            return end();
+        }
+        return it;
+    }
+
+    // Number of keys less than `key` among the first `count`.
+    template <typename K>
+    size_type lower_index(const Key* keys, size_type count, const K& key) const {
+        if constexpr (linear_search) {
+            size_type index = 0;
+            for (size_type i = 0; i < count; i++) {
+                index += keys[i] < key;
+            }
+            return index;
+        } else {
+            return std::lower_bound(keys, keys + count, key, compare_) - keys;
+        }
+    }
+
+    // Number of keys not greater than `key` among the first `count`.
+    template <typename K>
+    size_type upper_index(const Key* keys, size_type count, const K& key) const {
+        if constexpr (linear_search) {
+            size_type index = 0;
+            for (size_type i = 0; i < count; i++) {
+                index += !(key < keys[i]);
+            }
+            return index;
+        } else {
+            return std::upper_bound(keys, keys + count, key, compare_) - keys;
+        }
+    }
+
+    template <typename K>
+    leaf_node* descend(const K& key) const {
+        node* current = root_;
+        while (!current->leaf) {
+            auto* inner = static_cast<inner_node*>(current);
+            current = inner->children[upper_index(inner->keys, inner->count, key)];
+        }
+        return static_cast<leaf_node*>(current);
+    }
+
+    iterator normalize(leaf_node* leaf, size_type index) {
+        if (index == leaf->count) {
+            return iterator(this, leaf->next, 0);
+        }
+        return iterator(this, leaf, index);
+    }
+
+    static size_type child_index(const inner_node* parent, const node* child) {
+        return std::find(parent->children, parent->children + parent->count + 1, child) - parent->children;
+    }
+
+    template <typename K, typename V>
+    std::pair<iterator, bool> insert_unique(K&& key, V&& value) {
+        if (root_ == nullptr) {
+            head_ = tail_ = new leaf_node();
+            root_ = head_;
+        }
+
+        leaf_node* leaf = descend(key);
+        size_type index = lower_index(leaf->keys, leaf->count, key);
+        if (index < leaf->count && !compare_(key, leaf->keys[index])) {
+            return {iterator(this, leaf, index), false};
+        }
+        return {insert_at(leaf, index, std::forward<K>(key), std::forward<V>(value)), true};
+    }
+
+    template <typename K, typename V>
+    iterator insert_at(leaf_node* leaf, size_type index, K&& key, V&& value) {
+        if (leaf->count == node_slots) {
+            // Appends leave the full leaf behind, so ordered loads pack leaves.
+            bool append = leaf == tail_ && index == leaf->count;
+            leaf_node* right = split_leaf(leaf, append ? leaf->count - 1 : leaf->count / 2);
+            if (index > leaf->count) {
+                index -= leaf->count;
+                leaf = right;
+            }
+        }
+
+        std::move_backward(leaf->keys + index, leaf->keys + leaf->count, leaf->keys + leaf->count + 1);
+        std::move_backward(leaf->values + index, leaf->values + leaf->count, leaf->values + leaf->count + 1);
+        leaf->keys[index] = std::forward<K>(key);
+        leaf->values[index] = std::forward<V>(value);
+        leaf->count++;
+        size_++;
+        return iterator(this, leaf, index);
+    }
+
+    leaf_node* split_leaf(leaf_node* leaf, size_type half) {
+        auto* right = new leaf_node();
+        right->count = leaf->count - half;
+        std::move(leaf->keys + half, leaf->keys + leaf->count, right->keys);
+        std::move(leaf->values + half, leaf->values + leaf->count, right->values);
+        leaf->count = half;
+
+        right->next = leaf->next;
+        right->prev = leaf;
+        (leaf->next != nullptr ? leaf->next->prev : tail_) = right;
+        leaf->next = right;
+
+        insert_child(leaf, right->keys[0], right);
+        return right;
+    }
+
+    // Registers `right` as the sibling after `left`, separated by `key`.
+    void insert_child(node* left, const key_type& key, node* right) {
+        inner_node* parent = left->parent;
+        if (parent == nullptr) {
+            parent = new inner_node();
+            parent->children[0] = left;
+            left->parent = parent;
+            root_ = parent;
+        } else if (parent->count == node_slots) {
+            inner_node* sibling = split_inner(parent);
+            if (left->parent == sibling) {
+                parent = sibling;
+            }
+        }
+
+        size_type index = child_index(parent, left);
+        std::move_backward(parent->keys + index, parent->keys + parent->count, parent->keys + parent->count + 1);
+        std::move_backward(parent->children + index + 1, parent->children + parent->count + 1, parent->children + parent->count + 2);
+        parent->keys[index] = key;
+        parent->children[index + 1] = right;
+        parent->count++;
+        right->parent = parent;
+    }
+
+    inner_node* split_inner(inner_node* inner) {
+        auto* right = new inner_node();
+        size_type half = inner->count / 2;
+        key_type separator = inner->keys[half];
+
+        right->count = inner->count - half - 1;
+        std::move(inner->keys + half + 1, inner->keys + inner->count, right->keys);
+        std::copy(inner->children + half + 1, inner->children + inner->count + 1, right->children);
+        for (size_type i = 0; i <= right->count; i++) {
+            right->children[i]->parent = right;
+        }
+        inner->count = half;
+
+        insert_child(inner, separator, right);
+        return right;
+    }
+
+    // Restores the minimum fill of `target` by merging it with a sibling, or
+    // borrowing one entry when the two do not fit in a node.
+    void rebalance(node* target) {
+        inner_node* parent = target->parent;
+        if (parent == nullptr) {
+            if (!target->leaf && target->count == 0) {
+                root_ = static_cast<inner_node*>(target)->children[0];
+                root_->parent = nullptr;
+                delete static_cast<inner_node*>(target);
+            }
+            return;
+        }
+
+        if (target->count >= min_slots) {
+            return;
+        }
+
+        size_type index = child_index(parent, target);
+        size_type left = index > 0 ? index - 1 : index;
+        node* left_node = parent->children[left];
+        node* right_node = parent->children[left + 1];
+        size_type merged = left_node->count + right_node->count + (target->leaf ? 0 : 1);
+
+        if (merged <= node_slots) {
+            if (target->leaf) {
+                merge_leaves(static_cast<leaf_node*>(left_node), static_cast<leaf_node*>(right_node));
+            } else {
+                merge_inner(static_cast<inner_node*>(left_node), static_cast<inner_node*>(right_node), parent->keys[left]);
+            }
+
+            std::move(parent->keys + left + 1, parent->keys + parent->count, parent->keys + left);
+            std::copy(parent->children + left + 2, parent->children + parent->count + 1, parent->children + left + 1);
+            parent->count--;
+            rebalance(parent);
+        } else if (target->leaf) {
+            borrow_leaf(static_cast<leaf_node*>(left_node), static_cast<leaf_node*>(right_node), parent->keys[left], index == left);
+        } else {
+            borrow_inner(static_cast<inner_node*>(left_node), static_cast<inner_node*>(right_node), parent->keys[left], index == left);
+        }
+    }
+
+    void merge_leaves(leaf_node* left, leaf_node* right) {
+        std::move(right->keys, right->keys + right->count, left->keys + left->count);
+        std::move(right->values, right->values + right->count, left->values + left->count);
+        left->count += right->count;
+
+        left->next = right->next;
+        (right->next != nullptr ? right->next->prev : tail_) = left;
+        delete right;
+    }
+
+    void merge_inner(inner_node* left, inner_node* right, const key_type& separator) {
+        left->keys[left->count] = separator;
+        std::move(right->keys, right->keys + right->count, left->keys + left->count + 1);
+        std::copy(right->children, right->children + right->count + 1, left->children + left->count + 1);
+        for (size_type i = 0; i <= right->count; i++) {
+            right->children[i]->parent = left;
+        }
+        left->count += right->count + 1;
+        delete right;
+    }
+
+    void borrow_leaf(leaf_node* left, leaf_node* right, key_type& separator, bool into_left) {
+        if (into_left) {
+            left->keys[left->count] = std::move(right->keys[0]);
+            left->values[left->count] = std::move(right->values[0]);
+            left->count++;
+            std::move(right->keys + 1, right->keys + right->count, right->keys);
+            std::move(right->values + 1, right->values + right->count, right->values);
+            right->count--;
+        } else {
+            std::move_backward(right->keys, right->keys + right->count, right->keys + right->count + 1);
+            std::move_backward(right->values, right->values + right->count, right->values + right->count + 1);
+            right->keys[0] = std::move(left->keys[left->count - 1]);
+            right->values[0] = std::move(left->values[left->count - 1]);
+            right->count++;
+            left->count--;
+        }
+        separator = right->keys[0];
+    }
+
+    void borrow_inner(inner_node* left, inner_node* right, key_type& separator, bool into_left) {
+        if (into_left) {
+            left->keys[left->count] = separator;
+            left->children[left->count + 1] = right->children[0];
+            left->children[left->count + 1]->parent = left;
+            left->count++;
+
+            separator = right->keys[0];
+            std::move(right->keys + 1, right->keys + right->count, right->keys);
+            std::copy(right->children + 1, right->children + right->count + 1, right->children);
+            right->count--;
+        } else {
+            std::move_backward(right->keys, right->keys + right->count, right->keys + right->count + 1);
+            std::copy_backward(right->children, right->children + right->count + 1, right->children + right->count + 2);
+            right->keys[0] = separator;
+            right->children[0] = left->children[left->count];
+            right->children[0]->parent = right;
+            right->count++;
+
+            separator = left->keys[left->count - 1];
+            left->count--;
+        }
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,143 @@
+#ifndef HSF_EPOCH_H
+#define HSF_EPOCH_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace hsf {
+
+// Small thread ids, recycled on thread exit, used to index reader slots.
+inline size_t epoch_thread_id() {
+    struct registry {
+        std::mutex mutex;
+        std::vector<size_t> free_ids;
+        size_t next_id = 0;
+    };
+
+    struct registration {
+        registry& owner;
+        size_t id;
+
+        explicit registration(registry& owner) : owner(owner) {
+            std::lock_guard<std::mutex> lock(owner.mutex);
+            if (owner.free_ids.empty()) {
+                id = owner.next_id++;
+            } else {
+                id = owner.free_ids.back();
+                owner.free_ids.pop_back();
+            }
+        }
+
+        ~registration() {
+            std::lock_guard<std::mutex> lock(owner.mutex);
+            owner.free_ids.push_back(id);
+        }
+    };
+
+    static registry ids;
+    thread_local registration self(ids);
+    return self.id;
+}
+
+struct null_epoch_domain {};
+
+// Epoch-based reclamation. Readers publish the epoch they entered with a
+// plain store to their own slot, so pinning never performs a read-modify-write
+// on shared memory; writers retire objects and free them once every pinned
+// reader has moved past the retiring epoch.
+class epoch_domain {
+public:
+    class pin_guard {
+    public:
+        explicit pin_guard(const epoch_domain& domain)
+            : slot_(&domain.slot().epoch) {
+            slot_->store(domain.epoch_.load());
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+        }
+
+        pin_guard(const pin_guard&) = delete;
+        pin_guard& operator=(const pin_guard&) = delete;
+
+        ~pin_guard() {
+            slot_->store(idle, std::memory_order_release);
+        }
+
+    private:
+        std::atomic<uint64_t>* slot_;
+    };
+
+    explicit epoch_domain(size_t max_threads = 256)
+        : slots_(max_threads), epoch_(1) {}
+
+    epoch_domain(const epoch_domain&) = delete;
+    epoch_domain& operator=(const epoch_domain&) = delete;
+
+    ~epoch_domain() {
+        for (auto& [epoch, object] : retired_) {
+            object.second(object.first);
+        }
+    }
+
+    pin_guard pin() const {
+        return pin_guard(*this);
+    }
+
+    template <typename T>
+    void retire(T* object) {
+        if (object == nullptr) {
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        uint64_t epoch = epoch_.fetch_add(1);
+        retired_.push_back({epoch, {object, [](void* p) { delete static_cast<T*>(p); }}});
+        reclaim();
+    }
+
+private:
+    static constexpr uint64_t idle = UINT64_MAX;
+
+    struct alignas(64) slot_type {
+        std::atomic<uint64_t> epoch{idle};
+    };
+
+    using retired_object = std::pair<void*, void (*)(void*)>;
+
+    std::vector<slot_type> slots_;
+    std::atomic<uint64_t> epoch_;
+    std::mutex mutex_;
+    std::vector<std::pair<uint64_t, retired_object>> retired_;
+
+    slot_type& slot() const {
+        size_t id = epoch_thread_id();
+        if (id >= slots_.size()) {
+            throw std::length_error("epoch_domain: too many threads");
+        }
+        return const_cast<slot_type&>(slots_[id]);
+    }
+
+    void reclaim() {
+        uint64_t oldest = idle;
+        for (const auto& slot : slots_) {
+            oldest = std::min(oldest, slot.epoch.load());
+        }
+
+        auto it = std::partition(retired_.begin(), retired_.end(), [&](const auto& entry) {
+            return entry.first >= oldest;
+        });
+
+        for (auto freed = it; freed != retired_.end(); freed++) {
+            freed->second.second(freed->second.first);
+        }
+        retired_.erase(it, retired_.end());
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,149 @@
+#ifndef HSF_FILTER_H
+#define HSF_FILTER_H
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <type_traits>
+#include <vector>
+
+namespace hsf {
+
+template <typename Key>
+struct null_filter {
+    template <typename K>
+    static uint64_t hash(const K&) {
+        return 0;
+    }
+
+    bool contains(uint64_t) const {
+        return true;
+    }
+
+    void insert(uint64_t) {}
+    void erase(uint64_t) {}
+    void reset(size_t) {}
+
+    size_t size() const {
+        return 0;
+    }
+
+    size_t capacity() const {
+        return SIZE_MAX;
+    }
+};
+
+// Blocked counting Bloom filter: all probes of a key fall into one cache
+// line of 4-bit counters, so a negative lookup costs a single miss and keys
+// can be erased again. Saturated counters are never decremented.
+template <typename Key, typename Hash = std::hash<Key>, size_t CountersPerKey = 10, size_t Probes = 7>
+class counting_bloom_filter {
+public:
+    explicit counting_bloom_filter(size_t capacity = 0) {
+        reset(capacity);
+    }
+
+    // Lookup types other than Key are hashed directly if Hash accepts them
+    // (as std::hash<string_key> does std::string_view) and converted otherwise.
+    template <typename K>
+    static uint64_t hash(const K& key) {
+        uint64_t x;
+        if constexpr (std::is_invocable_v<Hash, const K&>) {
+            x = static_cast<uint64_t>(Hash{}(key));
+        } else {
+            x = static_cast<uint64_t>(Hash{}(Key(key)));
+        }
+        x ^= x >> 33;
+        x *= 0xff51afd7ed558ccdULL;
+        x ^= x >> 33;
+        x *= 0xc4ceb9fe1a85ec53ULL;
+        x ^= x >> 33;
+        return x;
+    }
+
+    bool contains(uint64_t hash) const {
+        const uint8_t* block = block_of(hash);
+        for (size_t i = 0; i < Probes; i++) {
+            if (counter(block, probe(hash, i)) == 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void insert(uint64_t hash) {
+        uint8_t* block = block_of(hash);
+        for (size_t i = 0; i < Probes; i++) {
+            size_t index = probe(hash, i);
+            uint8_t value = counter(block, index);
+            if (value < max_count) {
+                set_counter(block, index, value + 1);
+            }
+        }
+        size_++;
+    }
+
+    void erase(uint64_t hash) {
+        uint8_t* block = block_of(hash);
+        for (size_t i = 0; i < Probes; i++) {
+            size_t index = probe(hash, i);
+            uint8_t value = counter(block, index);
+            if (value > 0 && value < max_count) {
+                set_counter(block, index, value - 1);
+            }
+        }
+        size_--;
+    }
+
+    void reset(size_t capacity) {
+        size_t blocks = std::max<size_t>(1, (capacity * CountersPerKey + block_counters - 1) / block_counters);
+        counters_.assign(blocks * block_bytes, 0);
+        capacity_ = capacity;
+        size_ = 0;
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+    size_t capacity() const {
+        return capacity_;
+    }
+
+private:
+    static constexpr size_t block_bytes = 64;
+    static constexpr size_t block_counters = 2 * block_bytes;
+    static constexpr uint8_t max_count = 15;
+
+    std::vector<uint8_t> counters_;
+    size_t capacity_;
+    size_t size_;
+
+    const uint8_t* block_of(uint64_t hash) const {
+        size_t blocks = counters_.size() / block_bytes;
+        return counters_.data() + ((hash >> 32) * blocks >> 32) * block_bytes;
+    }
+
+    uint8_t* block_of(uint64_t hash) {
+        return const_cast<uint8_t*>(static_cast<const counting_bloom_filter*>(this)->block_of(hash));
+    }
+
+    static size_t probe(uint64_t hash, size_t i) {
+        uint32_t a = static_cast<uint32_t>(hash);
+        uint32_t b = static_cast<uint32_t>(hash >> 17) | 1;
+        return (a + i * b) % block_counters;
+    }
+
+    static uint8_t counter(const uint8_t* block, size_t index) {
+        return (block[index / 2] >> (4 * (index % 2))) & 0xf;
+    }
+
+    static void set_counter(uint8_t* block, size_t index, uint8_t value) {
+        uint8_t shift = 4 * (index % 2);
+        block[index / 2] = (block[index / 2] & ~(0xf << shift)) | (value << shift);
+    }
+};
+
+}
+
+#endif
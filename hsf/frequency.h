@@ -5,77 +5,438 @@
 #include <cassert>
 #include <cmath>
 #include <map>
+#include <numeric>
+#include <istream>
+#include <ostream>
 #include <queue>
+#include <stdexcept>
 #include <vector>
 
 #include "hsf.h"
+#include "pool.h"
 #include "prediction.h"
 
 namespace hsf {
 
 template <
+    typename Policy,
     typename Capacity,
     template <typename, typename, typename...> class Container,
     typename Key,
     typename... Args
 >
-class frequency_forest : public search_forest<frequency_forest<Capacity, Container, Key, Args...>> {
+class basic_frequency_forest : public search_forest<basic_frequency_forest<Policy, Capacity, Container, Key, Args...>> {
 public:
-    using parent_type = search_forest<frequency_forest<Capacity, Container, Key, Args...>>; 
+    using parent_type = search_forest<basic_frequency_forest<Policy, Capacity, Container, Key, Args...>>; 
     using key_type = typename parent_type::key_type;
     using value_type = typename parent_type::value_type;
     using size_type = typename parent_type::size_type;
     using iterator = typename parent_type::iterator;
+    using parent_type::set_budget;
+    using parent_type::weight;
+    using frequency_map = typename forest_traits<basic_frequency_forest>::frequency_map;
     
     template <typename... Params>
-    explicit frequency_forest(Params&&... params) 
+    explicit basic_frequency_forest(Params&&... params) 
         : parent_type(std::forward<Params>(params)...) {
-        frequencies_.emplace_back();
+        frequencies_.resize(parent_type::levels_.size());
     }
 
-    iterator find(const key_type& key, size_type hint = 0) {
-        auto it = parent_type::find(key, hint);
-        if (it == parent_type::end()) {
+    ~basic_frequency_forest() {
+        parent_type::stop_compaction();
+    }
+
+    template <typename K>
+    iterator find(const K& key, size_type hint = 0) {
+        if constexpr (parent_type::hot_levels > 0) {
+            auto it = parent_type::find_hot(key, hint, 1, true);
+            if (it != parent_type::end()) {
+                return it;
+            }
+        }
+
+        size_type moves = parent_type::resume_compaction();
+        while (true) {
+            auto it = parent_type::locate(key, hint);
+            if (it == parent_type::end()) {
+                parent_type::record_lookup(it);
+                return it;
+            }
+
+            size_type level = it.level();
+            level_guard guard(*this, moves);
+            guard.acquire(level > 0 ? level - 1 : level);
+            guard.acquire(level);
+            if constexpr (parent_type::concurrent) {
+                it = parent_type::find_in_level(key, level);
+                if (it == parent_type::end()) {
+                    continue;
+                }
+            }
+            parent_type::record_lookup(it);
+
+            apply_hits(level > 0 ? level - 1 : level);
+            apply_hits(level);
+
+            auto& freq_it = parent_type::metadata(*it);
+            auto node = frequencies_[level].extract(freq_it);
+            node.key() = node.key() + 1;
+            freq_it = frequencies_[level].insert(std::move(node));
+
+            auto new_frequency = freq_it->first;
+            size_type new_level = level;
+            while (new_level > 0 && guard.acquire(new_level - 1) && outranks(new_frequency, new_level - 1)) {
+                new_level--;
+            }
+
+            if (new_level != level) {
+                it = move_iterator(it, new_level, new_frequency);
+                compact_level(new_level, guard);
+                fill_level(level, guard);
+                it = parent_type::refresh(it, key);
+            }
+
             return it;
         }
+    }
 
-        size_type level = it.level();
-        auto node = frequencies_[level].extract(it->second);
-        node.key() = node.key() + 1;
-        it->second = frequencies_[level].insert(std::move(node));
+    // Looks up a batch of keys with one sweep per level, then applies their
+    // frequency updates, promotions and compactions once for the whole batch.
+    std::vector<iterator> find_batch(const std::vector<key_type>& keys, size_type hint = 0) {
+        level_guard guard(*this, parent_type::resume_compaction());
+        for (size_type i = hint > 0 ? hint - 1 : 0; i < parent_type::levels(); i++) {
+            guard.acquire(i);
+            apply_hits(i);
+        }
 
-        auto new_frequency = it->second->first;
-        size_type new_level = level;
-        while (new_level > 0 && new_frequency > frequencies_[new_level - 1].begin()->first) {
-            new_level--;
+        auto batch = parent_type::make_batch(keys, std::vector<size_type>(keys.size(), hint));
+        auto found = parent_type::locate_batch(batch.keys, batch.hints, false);
+        parent_type::record_lookups(batch, found);
+        for (size_type k = 0; k < found.size(); k++) {
+            if (found[k] != parent_type::end()) {
+                auto& it = found[k];
+                auto& freq_it = parent_type::metadata(*it);
+                auto node = frequencies_[it.level()].extract(freq_it);
+                node.key() = node.key() + batch.counts[k];
+                freq_it = frequencies_[it.level()].insert(std::move(node));
+            }
         }
 
-        if (new_level != level) {
-            it = move_iterator(it, new_level, new_frequency);
-            compact_level(new_level);
-            fill_level(level);
+        std::vector<size_type> from_levels;
+        std::vector<size_type> to_levels;
+        for (size_type k = 0; k < found.size(); k++) {
+            auto& it = found[k];
+            if (it == parent_type::end()) {
+                continue;
+            }
+
+            it = parent_type::refresh(it, batch.keys[k]);
+            size_type level = it.level();
+            auto new_frequency = parent_type::metadata(*it)->first;
+            size_type new_level = level;
+            while (new_level > 0 && guard.acquire(new_level - 1) && outranks(new_frequency, new_level - 1)) {
+                new_level--;
+            }
+
+            if (new_level != level) {
+                it = move_iterator(it, new_level, new_frequency);
+                from_levels.push_back(level);
+                to_levels.push_back(new_level);
+            }
         }
 
-        return it;
+        if (!to_levels.empty()) {
+            std::sort(to_levels.begin(), to_levels.end());
+            to_levels.erase(std::unique(to_levels.begin(), to_levels.end()), to_levels.end());
+            for (size_type level : to_levels) {
+                compact_level(level, guard);
+            }
+
+            std::sort(from_levels.rbegin(), from_levels.rend());
+            from_levels.erase(std::unique(from_levels.begin(), from_levels.end()), from_levels.end());
+            for (size_type level : from_levels) {
+                fill_level(level, guard);
+            }
+
+            for (size_type k = 0; k < found.size(); k++) {
+                batch.hints[k] = found[k].level();
+            }
+            found = parent_type::locate_batch(batch.keys, batch.hints, false);
+        }
+
+        return parent_type::scatter(batch, found);
     }
 
     iterator insert(const key_type& key, size_type frequency = 0) {
+        return emplace(key, frequency);
+    }
+
+    // Inserts a new key; in a mapped forest its payload is constructed in
+    // place from `params`. Returns end() if a budget evicts the key at once.
+    template <typename... Params>
+    iterator emplace(const key_type& key, size_type frequency, Params&&... params) {
+        level_guard guard(*this, parent_type::resume_compaction());
+        return emplace_locked(key, frequency, guard, std::forward<Params>(params)...);
+    }
+
+    // Inserts a key unless present, in which case its level is left as is
+    // and the access is not counted. Every level is held from the lookup to
+    // the insert, so concurrent calls never both insert the key.
+    template <typename... Params>
+    std::pair<iterator, bool> try_emplace(const key_type& key, size_type frequency, Params&&... params) {
+        level_guard guard(*this, parent_type::resume_compaction());
+        parent_type::acquire_all(guard);
+        auto it = parent_type::find_from(key, 0);
+        if (it != parent_type::end()) {
+            return {it, false};
+        }
+        return {emplace_locked(key, frequency, guard, std::forward<Params>(params)...), true};
+    }
+
+    // Erases a key and its frequency, then refills its level from the levels
+    // above. Returns the number of keys erased.
+    template <typename K>
+    size_type erase(const K& key) {
+        while (true) {
+            auto it = parent_type::locate(key, 0);
+            if (it == parent_type::end()) {
+                return 0;
+            }
+
+            if constexpr (!parent_type::concurrent) {
+                erase(it);
+                return 1;
+            } else {
+                size_type level = it.level();
+                level_guard guard(*this);
+                for (size_type i = 0; i <= level; i++) {
+                    guard.acquire(i);
+                }
+
+                it = parent_type::find_in_level(key, level);
+                if (it == parent_type::end()) {
+                    continue;
+                }
+                erase_entry(it);
+                fill_level(level, guard);
+                return 1;
+            }
+        }
+    }
+
+    // Erases the key at `it`. Concurrent forests erase by key, since their
+    // iterators may be moved from under them.
+    void erase(iterator it) {
+        static_assert(!parent_type::concurrent, "frequency_forest: concurrent forests erase by key");
+        size_type level = it.level();
+        erase_entry(it);
+        level_guard guard(*this, parent_type::resume_compaction());
+        fill_level(level, guard);
+    }
+
+    // Builds an empty forest from (key, frequency) pairs, filling each level
+    // to its minimum capacity in order of decreasing frequency.
+    template <typename InputIt>
+    void bulk_load(InputIt first, InputIt last, bool parallel = false) {
+        static_assert(!parent_type::is_map, "frequency_forest: bulk_load builds sets only");
+        if (parent_type::size() != 0) {
+            throw std::logic_error("frequency_forest: bulk_load into a non-empty forest");
+        }
+
+        std::vector<std::pair<key_type, uint32_t>> items;
+        for (; first != last; ++first) {
+            items.emplace_back(first->first, first->second);
+        }
+
+        auto buckets = parent_type::partition_levels(items.size(), [&](size_type left, size_type right) {
+            return items[left].second > items[right].second;
+        });
+
+        if (frequencies_.size() < buckets.size()) {
+            frequencies_.resize(buckets.size());
+        }
+
+        parent_type::build_levels(buckets.size(), [&](size_type level) {
+            auto& bucket = buckets[level];
+            std::vector<size_type> by_frequency(bucket.size());
+            std::iota(by_frequency.begin(), by_frequency.end(), 0);
+            std::sort(by_frequency.begin(), by_frequency.end(), [&](size_type left, size_type right) {
+                return items[bucket[left]].second < items[bucket[right]].second;
+            });
+
+            auto& level_frequencies = frequencies_[level];
+            std::vector<typename frequency_map::iterator> freq_its(bucket.size());
+            for (size_type i : by_frequency) {
+                const auto& [key, frequency] = items[bucket[i]];
+                freq_its[i] = level_frequencies.emplace_hint(level_frequencies.end(), frequency, key);
+            }
+
+            std::vector<value_type> values;
+            values.reserve(bucket.size());
+            for (size_type i = 0; i < bucket.size(); i++) {
+                values.push_back({items[bucket[i]].first, freq_its[i]});
+            }
+            return values;
+        }, parallel);
+    }
+
+    // Writes every level's keys in increasing frequency, with their
+    // frequencies and payloads. Holds all levels while writing.
+    void save(std::ostream& out) {
+        level_guard guard(*this);
+        for (size_type level = 0; level < parent_type::levels(); level++) {
+            guard.acquire(level);
+            apply_hits(level);
+        }
+
+        parent_type::write_header(out, snapshot_kind);
+        for (size_type level = 0; level < parent_type::levels(); level++) {
+            serializer<uint64_t>::write(out, frequencies_[level].size());
+            for (const auto& [frequency, key] : frequencies_[level]) {
+                serializer<key_type>::write(out, key);
+                serializer<uint32_t>::write(out, frequency);
+                if constexpr (parent_type::is_map) {
+                    parent_type::write_payload(out, *parent_type::find_in_level(key, level));
+                }
+            }
+        }
+
+        if (!out) {
+            throw std::runtime_error("frequency_forest: snapshot write failed");
+        }
+    }
+
+    // Restores a snapshot into an empty forest with the saved level layout,
+    // bulk building each level without compacting.
+    void load(std::istream& in, bool parallel = false) {
+        if (parent_type::size() != 0) {
+            throw std::logic_error("frequency_forest: load into a non-empty forest");
+        }
+
+        size_type count = parent_type::read_header(in, snapshot_kind);
+        std::vector<frequency_map> frequencies(count);
+        std::vector<std::vector<value_type>> values(count);
+        for (size_type level = 0; level < count; level++) {
+            auto size = read_checked<uint64_t>(in);
+            for (uint64_t i = 0; i < size; i++) {
+                auto key = read_checked<key_type>(in);
+                auto frequency = read_checked<uint32_t>(in);
+                auto freq_it = frequencies[level].emplace_hint(frequencies[level].end(), frequency, key);
+                values[level].push_back({std::move(key), parent_type::read_entry(in, freq_it)});
+            }
+        }
+
+        if (frequencies_.size() < count) {
+            frequencies_.resize(count);
+        }
+        for (size_type level = 0; level < count; level++) {
+            frequencies_[level].swap(frequencies[level]);
+        }
+
+        parent_type::build_levels(count, [&](size_type level) {
+            return std::move(values[level]);
+        }, parallel);
+    }
+
+private:
+    friend parent_type;
+    using level_guard = typename parent_type::level_guard;
+    using metadata_type = typename parent_type::metadata_type;
+
+    static constexpr uint32_t snapshot_kind = 1;
+
+    std::vector<frequency_map> frequencies_;
+
+    // The lowest frequency in `level`, read under a shared lock unless the
+    // operation already holds the level, as try_emplace does every level.
+    uint32_t min_frequency(size_type level, const level_guard& guard) const {
+        if (guard.holds(level)) {
+            return min_frequency_unlocked(level);
+        }
+        std::shared_lock<typename parent_type::mutex_type> lock(parent_type::level_mutex(level));
+        return min_frequency_unlocked(level);
+    }
+
+    uint32_t min_frequency_unlocked(size_type level) const {
+        return frequencies_[level].empty() ? UINT32_MAX : frequencies_[level].begin()->first;
+    }
+
+    // Whether a key with `frequency` belongs in `level` or above. Evictions
+    // and erasures can leave levels empty, which a key then enters only
+    // ahead of every key in the next non-empty level, such as its own.
+    bool outranks(uint32_t frequency, size_type level) const {
+        if (frequencies_[level].empty()) {
+            size_type below = level + 1;
+            while (frequencies_[below].empty()) {
+                below++;
+            }
+            return frequency >= frequencies_[below].rbegin()->first;
+        }
+        return frequency > frequencies_[level].begin()->first;
+    }
+
+    // Inserts a key at the level its frequency ranks it in, holding that
+    // level in `guard`.
+    template <typename... Params>
+    iterator emplace_locked(const key_type& key, size_type frequency, level_guard& guard, Params&&... params) {
         size_type level = parent_type::levels() - 1;
-        while (level > 0 && frequency > 0 && frequency >= frequencies_[level - 1].begin()->first) {
+        while (level > 0 && frequency > 0 && frequency >= min_frequency(level - 1, guard)) {
             level--;
         }
 
+        guard.acquire(level);
         auto freq_it = frequencies_[level].insert({frequency, key});
-        auto it = parent_type::insert({key, freq_it}, level);
-        compact_level(level);
-        return it;
+        auto entry = parent_type::make_entry(freq_it, std::forward<Params>(params)...);
+        auto it = parent_type::insert({key, std::move(entry)}, level);
+        parent_type::charge(it);
+        compact_level(level, guard);
+        if (parent_type::over_budget()) {
+            evict_over_budget(guard);
+            return parent_type::find_from(key, level);
+        }
+        return parent_type::refresh(it, key);
     }
 
-private:
-    std::vector<std::multimap<uint32_t, key_type>> frequencies_;
+    // Evicts the least frequently accessed keys of the lowest non-empty level,
+    // oldest first among equal frequencies, until the forest is within budget.
+    void evict_over_budget(level_guard& guard) {
+        size_type level = parent_type::levels() - 1;
+        while (parent_type::over_budget() && guard.acquire(level)) {
+            if (frequencies_[level].empty()) {
+                if (level == 0) {
+                    return;
+                }
+                level--;
+                continue;
+            }
+
+            apply_hits(level);
+            auto min_it = frequencies_[level].begin();
+            parent_type::evict(parent_type::find_in_level(min_it->second, level));
+            frequencies_[level].erase(min_it);
+        }
+    }
+
+    // Erases a key with its frequency; the caller holds its level.
+    void erase_entry(iterator it) {
+        frequencies_[it.level()].erase(parent_type::metadata(*it));
+        parent_type::discard(it);
+    }
+
+    void apply_hits(size_type level) {
+        parent_type::drain_hits(level, [&](const key_type& key, uint32_t hits) {
+            auto it = parent_type::find_in_level(key, level);
+            if (it != parent_type::end()) {
+                auto& freq_it = parent_type::metadata(*it);
+                auto node = frequencies_[level].extract(freq_it);
+                node.key() = node.key() + hits;
+                freq_it = frequencies_[level].insert(std::move(node));
+            }
+        });
+    }
 
     iterator move_key(const key_type& key, size_type from_level, size_type to_level, uint32_t frequency) {
-        auto from_it = parent_type::find(key, from_level);
+        auto from_it = parent_type::find_in_level(key, from_level);
         if (from_it == parent_type::end()) {
             return parent_type::end();
         }
@@ -88,60 +449,120 @@ private:
             frequencies_.emplace_back();
         }
 
-        auto node = frequencies_[from_it.level()].extract(from_it->second);
+        auto node = frequencies_[from_it.level()].extract(parent_type::metadata(*from_it));
         node.key() = frequency;
         auto freq_it = frequencies_[to_level].insert(std::move(node));
-
-        auto key = from_it->first;
-        parent_type::erase(from_it);
-        return parent_type::insert({key, freq_it}, to_level);
+        return parent_type::relocate(from_it, freq_it, to_level);
     }
 
-    void compact_level(size_type level) {
+    void compact_level(size_type level, level_guard& guard) {
         auto [min_cap, max_cap] = parent_type::capacity(level);
         size_type level_size = parent_type::size(level);
 
-        if (level_size > max_cap) {
-            while (level_size > min_cap) {
+        if (level_size > max_cap && !parent_type::defer_compaction(level, level_size, max_cap, guard) && guard.acquire(level + 1)) {
+            apply_hits(level);
+            while (level + 1 >= frequencies_.size()) {
+                frequencies_.emplace_back();
+            }
+
+            // Moves the least frequent keys' metadata first, then the keys
+            // themselves in one pass over both levels.
+            size_type count = guard.spend(level_size - min_cap);
+            std::vector<std::pair<key_type, metadata_type>> entries;
+            entries.reserve(count);
+            for (size_type i = 0; i < count; i++) {
                 assert(!frequencies_[level].empty());
-                auto [min_freq, min_key] = *frequencies_[level].begin();
-                move_key(min_key, level, level + 1, min_freq);
-                level_size--;
+                auto node = frequencies_[level].extract(frequencies_[level].begin());
+                key_type key = node.mapped();
+                entries.emplace_back(std::move(key), frequencies_[level + 1].insert(std::move(node)));
+            }
+            parent_type::relocate_batch(level, entries, level + 1);
+
+            // An operation out of moves may not have created the next level.
+            if (level + 1 < parent_type::levels()) {
+                compact_level(level + 1, guard);
             }
-            
-            compact_level(level + 1);
         }
         
         assert(frequencies_[level].size() == parent_type::size(level));
     }
     
-    void fill_level(size_type level) {
+    void fill_level(size_type level, level_guard& guard) {
         auto [min_cap, _] = parent_type::capacity(level);
         size_type level_size = parent_type::size(level);
 
-        if (level == 0 || level == parent_type::levels() - 1 || level_size >= min_cap) {
+        if (level == 0 || level == parent_type::levels() - 1 || level_size >= min_cap
+                || parent_type::defer_compaction(level, level_size, min_cap, guard)) {
             return;
         }
 
-        assert(!frequencies_[level - 1].empty());
-        assert(frequencies_[level - 1].begin()->first >= frequencies_[level].rbegin()->first);
-        
-        auto [min_freq, min_key] = *frequencies_[level - 1].begin();
-        move_key(min_key, level - 1, level, min_freq);
-        fill_level(level - 1);
+        if (!guard.acquire(level - 1)) {
+            return;
+        }
+
+        apply_hits(level - 1);
+        while (level_size < min_cap && !frequencies_[level - 1].empty() && guard.spend()) {
+            // Concurrent promotions stop at levels they cannot lock, so only
+            // single-threaded forests keep frequencies ordered across levels.
+            assert(parent_type::concurrent || level_size == 0
+                || frequencies_[level - 1].begin()->first >= frequencies_[level].rbegin()->first);
+
+            auto [min_freq, min_key] = *frequencies_[level - 1].begin();
+            move_key(min_key, level - 1, level, min_freq);
+            level_size++;
+        }
+        fill_level(level - 1, guard);
+    }
+
+    // Restores a level marked for the compactor, which holds it and the
+    // level above.
+    void rebalance(size_type level, level_guard& guard) {
+        compact_level(level, guard);
+        fill_level(level, guard);
+    }
+
+    // Brings a level within new capacities: compacts it if it overflows, or
+    // lifts the most frequent keys of the levels below into it if it falls
+    // short, emptying each before the next and leaving them to be reshaped
+    // in turn.
+    void reshape_level(size_type level, level_guard& guard) {
+        compact_level(level, guard);
+
+        auto [min_cap, _] = parent_type::capacity(level);
+        for (size_type below = level + 1; below < parent_type::levels() && parent_type::size(level) < min_cap; below++) {
+            if (guard.exhausted() || !guard.acquire(below)) {
+                return;
+            }
+
+            apply_hits(below);
+            size_type count = guard.spend(std::min<size_type>(min_cap - parent_type::size(level), frequencies_[below].size()));
+            std::vector<std::pair<key_type, metadata_type>> entries;
+            entries.reserve(count);
+            for (size_type i = 0; i < count; i++) {
+                auto node = frequencies_[below].extract(std::prev(frequencies_[below].end()));
+                key_type key = node.mapped();
+                entries.emplace_back(std::move(key), frequencies_[level].insert(std::move(node)));
+            }
+            parent_type::relocate_batch(below, entries, level);
+        }
     }
 };
 
 template <
+    typename Policy,
     typename Capacity,
     template <typename, typename, typename...> class Container,
     typename Key,
     typename... Args
 >
-struct forest_traits<frequency_forest<Capacity, Container, Key, Args...>> {
-    using metadata_type = typename std::multimap<uint32_t, Key>::iterator;
-    using level_type = Container<Key, metadata_type, Args...>;
+struct forest_traits<basic_frequency_forest<Policy, Capacity, Container, Key, Args...>> {
+    using key_type = typename key_traits<Key>::key_type;
+    using mapped_type = typename key_traits<Key>::mapped_type;
+    using frequency_map = std::multimap<uint32_t, key_type, std::less<uint32_t>, pool_allocator<std::pair<const uint32_t, key_type>>>;
+    using metadata_type = typename frequency_map::iterator;
+    using level_type = Container<key_type, typename key_traits<Key>::template entry_type<metadata_type>, Args...>;
     using capacity_type = Capacity;
+    using policy_type = Policy;
 };
 
 template <
@@ -150,28 +571,226 @@ template <
     typename Key,
     typename... Args
 >
-class learned_frequency_forest : public search_forest<learned_frequency_forest<Capacity, Container, Key, Args...>> {
+using frequency_forest = basic_frequency_forest<single_threaded, Capacity, Container, Key, Args...>;
+
+template <
+    typename Capacity,
+    template <typename, typename, typename...> class Container,
+    typename Key,
+    typename... Args
+>
+using concurrent_frequency_forest = basic_frequency_forest<level_locking, Capacity, Container, Key, Args...>;
+
+template <
+    typename Policy,
+    typename Capacity,
+    template <typename, typename, typename...> class Container,
+    typename Key,
+    typename... Args
+>
+class basic_learned_frequency_forest : public search_forest<basic_learned_frequency_forest<Policy, Capacity, Container, Key, Args...>> {
 public:
-    using parent_type = search_forest<learned_frequency_forest<Capacity, Container, Key, Args...>>; 
+    using parent_type = search_forest<basic_learned_frequency_forest<Policy, Capacity, Container, Key, Args...>>; 
     using key_type = typename parent_type::key_type;
     using value_type = typename parent_type::value_type;
     using size_type = typename parent_type::size_type;
     using iterator = typename parent_type::iterator;
     using parent_type::parent_type;
 
-    iterator find(const key_type& key, size_type rank) {
-        size_type level = prediction_to_level(rank, parent_type::min_capacity_);
-        return parent_type::find(key, level);
+    ~basic_learned_frequency_forest() {
+        parent_type::stop_compaction();
     }
 
-    iterator insert(const key_type& key, size_type rank) {
+    template <typename K>
+    iterator find(const K& key, size_type rank) {
         size_type level = prediction_to_level(rank, parent_type::min_capacity_);
-        auto it = parent_type::insert({key, rank}, level);
-        compact_level(level);
+        auto it = parent_type::end();
+        if constexpr (parent_type::hot_levels > 0) {
+            it = parent_type::find_hot(key, level, parent_type::hot_levels, false);
+        }
+        if (it == parent_type::end()) {
+            it = parent_type::locate_around(key, level);
+            parent_type::record_lookup(it);
+        }
+        parent_type::record_prediction(level, it);
         return it;
     }
 
+    std::vector<iterator> find_batch(const std::vector<key_type>& keys, const std::vector<size_type>& ranks) {
+        std::vector<size_type> levels(keys.size());
+        for (size_type i = 0; i < keys.size(); i++) {
+            levels[i] = prediction_to_level(ranks[i], parent_type::min_capacity_);
+        }
+        auto found = parent_type::lookup_batch(keys, levels, true);
+        for (size_type i = 0; i < keys.size(); i++) {
+            parent_type::record_prediction(levels[i], found[i]);
+        }
+        return found;
+    }
+
+    iterator insert(const key_type& key, size_type rank) {
+        return emplace(key, rank);
+    }
+
+    template <typename... Params>
+    iterator emplace(const key_type& key, size_type rank, Params&&... params) {
+        level_guard guard(*this, parent_type::resume_compaction());
+        return emplace_locked(key, rank, guard, std::forward<Params>(params)...);
+    }
+
+    // Holds every level from the lookup to the insert, so concurrent calls
+    // never both insert the key.
+    template <typename... Params>
+    std::pair<iterator, bool> try_emplace(const key_type& key, size_type rank, Params&&... params) {
+        level_guard guard(*this, parent_type::resume_compaction());
+        parent_type::acquire_all(guard);
+        auto it = parent_type::find_from(key, 0);
+        if (it != parent_type::end()) {
+            return {it, false};
+        }
+        return {emplace_locked(key, rank, guard, std::forward<Params>(params)...), true};
+    }
+
+    // Erases a key. Learned levels have no minimum size, so nothing is
+    // refilled. Returns the number of keys erased.
+    template <typename K>
+    size_type erase(const K& key) {
+        while (true) {
+            auto it = parent_type::locate(key, 0);
+            if (it == parent_type::end()) {
+                return 0;
+            }
+
+            if constexpr (!parent_type::concurrent) {
+                erase(it);
+                return 1;
+            } else {
+                size_type level = it.level();
+                level_guard guard(*this);
+                guard.acquire(level);
+
+                it = parent_type::find_in_level(key, level);
+                if (it == parent_type::end()) {
+                    continue;
+                }
+                parent_type::discard(it);
+                return 1;
+            }
+        }
+    }
+
+    // Erases the key at `it`. Concurrent forests erase by key, since their
+    // iterators may be moved from under them.
+    void erase(iterator it) {
+        static_assert(!parent_type::concurrent, "learned_frequency_forest: concurrent forests erase by key");
+        parent_type::discard(it);
+    }
+
+    // Builds an empty forest from (key, rank) pairs, placing every key at its
+    // predicted level and splitting an overfull bottom level by rank.
+    template <typename InputIt>
+    void bulk_load(InputIt first, InputIt last, bool parallel = false) {
+        static_assert(!parent_type::is_map, "learned_frequency_forest: bulk_load builds sets only");
+        if (parent_type::size() != 0) {
+            throw std::logic_error("learned_frequency_forest: bulk_load into a non-empty forest");
+        }
+
+        std::vector<std::pair<key_type, uint32_t>> items;
+        std::vector<std::vector<size_type>> buckets(1);
+        for (; first != last; ++first) {
+            size_type level = prediction_to_level(first->second, parent_type::min_capacity_);
+            if (level >= buckets.size()) {
+                buckets.resize(level + 1);
+            }
+            buckets[level].push_back(items.size());
+            items.emplace_back(first->first, first->second);
+        }
+
+        while (buckets.back().size() > parent_type::capacity(buckets.size() - 1).second) {
+            auto& bottom = buckets.back();
+            size_type min_cap = parent_type::capacity(buckets.size() - 1).first;
+            std::vector<size_type> by_rank(bottom);
+            std::nth_element(by_rank.begin(), by_rank.begin() + min_cap, by_rank.end(), [&](size_type left, size_type right) {
+                return items[left].second < items[right].second;
+            });
+
+            std::vector<bool> overflow(items.size(), false);
+            for (auto it = by_rank.begin() + min_cap; it != by_rank.end(); it++) {
+                overflow[*it] = true;
+            }
+
+            std::vector<size_type> kept;
+            std::vector<size_type> next;
+            for (size_type i : bottom) {
+                (overflow[i] ? next : kept).push_back(i);
+            }
+            bottom = std::move(kept);
+            buckets.push_back(std::move(next));
+        }
+
+        parent_type::build_levels(buckets.size(), [&](size_type level) {
+            std::vector<value_type> values;
+            values.reserve(buckets[level].size());
+            for (size_type i : buckets[level]) {
+                values.push_back({items[i].first, items[i].second});
+            }
+            return values;
+        }, parallel);
+    }
+
+    // Writes every level's keys with their ranks and payloads. Holds all
+    // levels while writing.
+    void save(std::ostream& out) {
+        level_guard guard(*this);
+        for (size_type level = 0; level < parent_type::levels(); level++) {
+            guard.acquire(level);
+        }
+
+        parent_type::write_header(out, snapshot_kind);
+        for (size_type level = 0; level < parent_type::levels(); level++) {
+            serializer<uint64_t>::write(out, parent_type::size(level));
+            for (const auto& value : parent_type::levels_[level]) {
+                serializer<key_type>::write(out, value.first);
+                serializer<uint32_t>::write(out, parent_type::metadata(value));
+                parent_type::write_payload(out, value);
+            }
+        }
+
+        if (!out) {
+            throw std::runtime_error("learned_frequency_forest: snapshot write failed");
+        }
+    }
+
+    // Restores a snapshot into an empty forest with the saved level layout,
+    // bulk building each level without compacting.
+    void load(std::istream& in, bool parallel = false) {
+        if (parent_type::size() != 0) {
+            throw std::logic_error("learned_frequency_forest: load into a non-empty forest");
+        }
+
+        size_type count = parent_type::read_header(in, snapshot_kind);
+        std::vector<std::vector<value_type>> values(count);
+        for (size_type level = 0; level < count; level++) {
+            auto size = read_checked<uint64_t>(in);
+            for (uint64_t i = 0; i < size; i++) {
+                auto key = read_checked<key_type>(in);
+                auto rank = read_checked<uint32_t>(in);
+                values[level].push_back({std::move(key), parent_type::read_entry(in, rank)});
+            }
+        }
+
+        parent_type::build_levels(count, [&](size_type level) {
+            return std::move(values[level]);
+        }, parallel);
+    }
+
 private:
+    friend parent_type;
+    using level_guard = typename parent_type::level_guard;
+    using metadata_type = typename parent_type::metadata_type;
+
+    static constexpr uint32_t snapshot_kind = 2;
+
     struct heap_element {
         key_type key;
         uint32_t rank;
@@ -181,19 +800,31 @@ private:
         }
     };
 
+    // Inserts a key at its predicted level, holding that level in `guard`.
+    template <typename... Params>
+    iterator emplace_locked(const key_type& key, size_type rank, level_guard& guard, Params&&... params) {
+        size_type level = prediction_to_level(rank, parent_type::min_capacity_);
+        guard.acquire(level);
+        auto entry = parent_type::make_entry(rank, std::forward<Params>(params)...);
+        auto it = parent_type::insert({key, std::move(entry)}, level);
+        compact_level(level, guard);
+        return parent_type::refresh(it, key);
+    }
+
     iterator move_iterator(iterator from_it, size_type to_level) {
-        auto [key, rank] = *from_it;
-        parent_type::erase(from_it);
-        return parent_type::insert({key, rank}, to_level);
+        return parent_type::relocate(from_it, parent_type::metadata(*from_it), to_level);
     }
 
-    void compact_level(size_type level) {
+    void compact_level(size_type level, level_guard& guard) {
         auto [min_cap, max_cap] = parent_type::capacity(level);
         size_type level_size = parent_type::size(level);
 
-        if (level_size > max_cap && level == parent_type::levels() - 1) {
+        if (level_size > max_cap && level == parent_type::levels() - 1
+                && !parent_type::defer_compaction(level, level_size, max_cap, guard) && guard.acquire(level + 1)) {
             std::priority_queue<heap_element> max_ranks;
-            for (const auto& [key, rank] : parent_type::levels_[level]) {
+            for (const auto& value : parent_type::levels_[level]) {
+                const auto& key = value.first;
+                uint32_t rank = parent_type::metadata(value);
                 if (max_ranks.size() < level_size - min_cap) {
                     max_ranks.push({key, rank});
                 } else if (rank > max_ranks.top().rank) {
@@ -202,32 +833,66 @@ private:
                 }
             }
 
-            while (!max_ranks.empty()) {
-                auto element = max_ranks.top();
+            // Keeps the highest ranks, so a split cut short by the
+            // operation's moves still splits by rank.
+            size_type count = guard.spend(max_ranks.size());
+            while (max_ranks.size() > count) {
                 max_ranks.pop();
-
-                auto it = parent_type::find(element.key, level);
-                assert(it != parent_type::end());
-                move_iterator(it, level + 1);
             }
+            std::vector<std::pair<key_type, metadata_type>> entries;
+            entries.reserve(count);
+            for (; !max_ranks.empty(); max_ranks.pop()) {
+                entries.emplace_back(max_ranks.top().key, max_ranks.top().rank);
+            }
+            parent_type::relocate_batch(level, entries, level + 1);
 
-            compact_level(level + 1);
+            compact_level(level + 1, guard);
         }
     }
+
+    void rebalance(size_type level, level_guard& guard) {
+        compact_level(level, guard);
+    }
+
+    // Learned levels have no minimum size, so only an overflowing bottom
+    // level is split.
+    void reshape_level(size_type level, level_guard& guard) {
+        compact_level(level, guard);
+    }
 };
 
 template <
+    typename Policy,
     typename Capacity,
     template <typename, typename, typename...> class Container,
     typename Key,
     typename... Args
 >
-struct forest_traits<learned_frequency_forest<Capacity, Container, Key, Args...>> {
+struct forest_traits<basic_learned_frequency_forest<Policy, Capacity, Container, Key, Args...>> {
+    using key_type = typename key_traits<Key>::key_type;
+    using mapped_type = typename key_traits<Key>::mapped_type;
     using metadata_type = uint32_t;
-    using level_type = Container<Key, metadata_type, Args...>;
+    using level_type = Container<key_type, typename key_traits<Key>::template entry_type<metadata_type>, Args...>;
     using capacity_type = Capacity;
+    using policy_type = Policy;
 };
 
+template <
+    typename Capacity,
+    template <typename, typename, typename...> class Container,
+    typename Key,
+    typename... Args
+>
+using learned_frequency_forest = basic_learned_frequency_forest<single_threaded, Capacity, Container, Key, Args...>;
+
+template <
+    typename Capacity,
+    template <typename, typename, typename...> class Container,
+    typename Key,
+    typename... Args
+>
+using concurrent_learned_frequency_forest = basic_learned_frequency_forest<level_locking, Capacity, Container, Key, Args...>;
+
 }
 
 #endif
\ No newline at end of file
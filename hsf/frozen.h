@@ -0,0 +1,304 @@
+#ifndef HSF_FROZEN_H
+#define HSF_FROZEN_H
+
+#include <cerrno>
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace hsf {
+
+// Image of a frozen forest: a header, a table of levels and, per level, its
+// keys (and payloads) in Eytzinger order, i.e. as an implicit binary search
+// tree in BFS order with the root at index 1. Arrays start on cache lines.
+// Offsets are from the start of the image; integers are in host byte order.
+struct frozen_header {
+    uint32_t magic;
+    uint32_t levels;
+    uint32_t key_size;
+    uint32_t value_size;
+};
+
+struct frozen_level {
+    uint64_t size;
+    uint64_t min_capacity;
+    uint64_t max_capacity;
+    uint64_t keys;
+    uint64_t values;
+};
+
+constexpr uint32_t frozen_magic = 0x5a465348;
+constexpr uint64_t frozen_alignment = 64;
+
+// Sorted index of the key at each Eytzinger slot 1..n (slot 0 is unused).
+inline std::vector<size_t> eytzinger_order(size_t n) {
+    std::vector<size_t> order(n + 1);
+    size_t next = 0;
+    auto visit = [&](auto& self, size_t slot) -> void {
+        if (slot <= n) {
+            self(self, 2 * slot);
+            order[slot] = next++;
+            self(self, 2 * slot + 1);
+        }
+    };
+    visit(visit, 1);
+    return order;
+}
+
+// Writes an image with the sizes and capacities in `table`. `fill(level,
+// keys, values)` appends a level's keys (and payloads) in increasing order.
+template <typename Key, typename T, typename Fill>
+void write_frozen(std::ostream& out, std::vector<frozen_level> table, Fill fill) {
+    using value_type = std::conditional_t<std::is_void_v<T>, char, T>;
+    constexpr uint64_t value_size = std::is_void_v<T> ? 0 : sizeof(value_type);
+    static_assert(std::is_trivially_copyable_v<Key> && std::is_trivially_copyable_v<value_type>,
+        "frozen_forest: keys and payloads must be trivially copyable");
+
+    auto align = [](uint64_t offset) {
+        return (offset + frozen_alignment - 1) / frozen_alignment * frozen_alignment;
+    };
+
+    uint64_t offset = sizeof(frozen_header) + table.size() * sizeof(frozen_level);
+    for (auto& level : table) {
+        level.keys = align(offset);
+        offset = level.keys + (level.size + 1) * sizeof(Key);
+        level.values = value_size == 0 ? 0 : align(offset);
+        offset = value_size == 0 ? offset : level.values + (level.size + 1) * value_size;
+    }
+
+    frozen_header header{frozen_magic, static_cast<uint32_t>(table.size()), sizeof(Key), value_size};
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(table.data()), table.size() * sizeof(frozen_level));
+    uint64_t written = sizeof(frozen_header) + table.size() * sizeof(frozen_level);
+    auto write_array = [&](uint64_t at, const auto& array, const std::vector<size_t>& order) {
+        for (; written < at; written++) {
+            out.put('\0');
+        }
+        for (size_t slot = 0; slot < order.size(); slot++) {
+            auto element = slot == 0 ? std::decay_t<decltype(array[0])>{} : array[order[slot]];
+            out.write(reinterpret_cast<const char*>(&element), sizeof(element));
+        }
+        written += order.size() * sizeof(array[0]);
+    };
+
+    for (size_t level = 0; level < table.size(); level++) {
+        std::vector<Key> keys;
+        std::vector<value_type> values;
+        keys.reserve(table[level].size);
+        fill(level, keys, values);
+        if (keys.size() != table[level].size) {
+            throw std::logic_error("frozen_forest: level changed while freezing");
+        }
+
+        auto order = eytzinger_order(keys.size());
+        write_array(table[level].keys, keys, order);
+        if (value_size != 0) {
+            write_array(table[level].values, values, order);
+        }
+    }
+
+    if (!out) {
+        throw std::runtime_error("frozen_forest: image write failed");
+    }
+}
+
+// Read-only view of a forest frozen with search_forest::freeze, mapped from
+// a file holding only the image. Lookups search the levels in place without
+// deserializing and prefetch the cache line four levels down each descent.
+// Processes mapping the same file share one page-cached copy.
+template <typename Key, typename T = void, typename Compare = std::less<Key>>
+class frozen_forest {
+public:
+    using key_type = Key;
+    using mapped_type = T;
+    using size_type = size_t;
+
+    struct iterator {
+    public:
+        const key_type& key() const {
+            return *key_;
+        }
+
+        template <typename U = T>
+        const U& value() const {
+            static_assert(!std::is_void_v<U>, "frozen_forest: value() of a set");
+            return *value_;
+        }
+
+        bool operator==(const iterator& other) const {
+            return key_ == other.key_;
+        }
+
+        bool operator!=(const iterator& other) const {
+            return !(*this == other);
+        }
+
+        size_type level() const {
+            return level_;
+        }
+
+    private:
+        friend class frozen_forest;
+        using value_pointer = std::conditional_t<std::is_void_v<T>, const void*, const T*>;
+
+        const key_type* key_ = nullptr;
+        value_pointer value_ = nullptr;
+        size_type level_ = 0;
+    };
+
+    explicit frozen_forest(const std::string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::system_error(errno, std::generic_category(), "frozen_forest: open " + path);
+        }
+
+        struct stat info;
+        if (::fstat(fd, &info) != 0 || info.st_size < static_cast<off_t>(sizeof(frozen_header))) {
+            ::close(fd);
+            throw std::runtime_error("frozen_forest: not a frozen forest: " + path);
+        }
+
+        bytes_ = info.st_size;
+        void* image = ::mmap(nullptr, bytes_, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (image == MAP_FAILED) {
+            throw std::system_error(errno, std::generic_category(), "frozen_forest: mmap " + path);
+        }
+
+        image_ = static_cast<const char*>(image);
+        if (!valid()) {
+            ::munmap(const_cast<char*>(image_), bytes_);
+            throw std::runtime_error("frozen_forest: not a frozen forest of this type: " + path);
+        }
+    }
+
+    frozen_forest(const frozen_forest&) = delete;
+    frozen_forest& operator=(const frozen_forest&) = delete;
+
+    frozen_forest(frozen_forest&& other) noexcept
+        : image_(std::exchange(other.image_, nullptr)), bytes_(std::exchange(other.bytes_, 0)) {}
+
+    frozen_forest& operator=(frozen_forest&& other) noexcept {
+        std::swap(image_, other.image_);
+        std::swap(bytes_, other.bytes_);
+        return *this;
+    }
+
+    ~frozen_forest() {
+        if (image_ != nullptr) {
+            ::munmap(const_cast<char*>(image_), bytes_);
+        }
+    }
+
+    // Searches levels [hint, levels()), as search_forest::find does.
+    template <typename K>
+    iterator find(const K& key, size_type hint = 0) const {
+        for (size_type i = hint; i < levels(); i++) {
+            const auto& level = table()[i];
+            const key_type* keys = reinterpret_cast<const key_type*>(image_ + level.keys);
+            size_type slot = lower_bound(keys, level.size, key);
+            if (slot != 0 && !compare_(key, keys[slot])) {
+                iterator it;
+                it.key_ = keys + slot;
+                if constexpr (!std::is_void_v<T>) {
+                    it.value_ = reinterpret_cast<const T*>(image_ + level.values) + slot;
+                }
+                it.level_ = i;
+                return it;
+            }
+        }
+        return end();
+    }
+
+    template <typename K>
+    bool contains(const K& key, size_type hint = 0) const {
+        return find(key, hint) != end();
+    }
+
+    iterator end() const {
+        return iterator();
+    }
+
+    size_type levels() const {
+        return header().levels;
+    }
+
+    size_type size(size_type level) const {
+        return table()[level].size;
+    }
+
+    size_type size() const {
+        size_type total = 0;
+        for (size_type i = 0; i < levels(); i++) {
+            total += size(i);
+        }
+        return total;
+    }
+
+    std::pair<size_type, size_type> capacity(size_type level) const {
+        return std::make_pair(table()[level].min_capacity, table()[level].max_capacity);
+    }
+
+private:
+    const char* image_ = nullptr;
+    size_t bytes_ = 0;
+    Compare compare_;
+
+    static constexpr size_type prefetch_stride = sizeof(key_type) < frozen_alignment
+        ? frozen_alignment / sizeof(key_type) : 1;
+
+    const frozen_header& header() const {
+        return *reinterpret_cast<const frozen_header*>(image_);
+    }
+
+    const frozen_level* table() const {
+        return reinterpret_cast<const frozen_level*>(image_ + sizeof(frozen_header));
+    }
+
+    // Eytzinger slot of the first key not less than `key`, or 0 if none.
+    // The descent is branchless; the final shift undoes the right turns
+    // taken after the last left turn.
+    template <typename K>
+    size_type lower_bound(const key_type* keys, size_type size, const K& key) const {
+        size_type slot = 1;
+        while (slot <= size) {
+            __builtin_prefetch(keys + slot * prefetch_stride);
+            slot = 2 * slot + compare_(keys[slot], key);
+        }
+        return slot >> __builtin_ffsll(~slot);
+    }
+
+    bool valid() const {
+        const auto& head = header();
+        constexpr uint64_t value_size = std::is_void_v<T> ? 0 : sizeof(std::conditional_t<std::is_void_v<T>, char, T>);
+        if (head.magic != frozen_magic || head.key_size != sizeof(key_type) || head.value_size != value_size
+                || sizeof(frozen_header) + uint64_t(head.levels) * sizeof(frozen_level) > bytes_) {
+            return false;
+        }
+
+        for (size_type i = 0; i < head.levels; i++) {
+            const auto& level = table()[i];
+            uint64_t slots = level.size + 1;
+            if (level.size >= bytes_ || level.keys % frozen_alignment != 0 || level.keys + slots * sizeof(key_type) > bytes_
+                    || (value_size != 0 && (level.values % frozen_alignment != 0 || level.values + slots * value_size > bytes_))) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,495 @@
+#ifndef HSF_HASH_TABLE_H
+#define HSF_HASH_TABLE_H
+
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace hsf {
+
+// Open-addressing level container with the interface of std::unordered_map,
+// for forests that never need keys in order. Slots are split into groups
+// of 16 with one control byte each: 7 bits of the key's hash if the slot is
+// full, or an empty or deleted marker. A lookup hashes once and compares a
+// whole group's control bytes with SSE2 (scalar otherwise), only comparing
+// keys whose hash bits match, and stops at the first group with an empty
+// slot. Tables stay at most 7/8 full.
+//
+// Entries are moved on rehash, so inserts invalidate iterators; erases do
+// not. Node handles move entries out of and into tables, as levels of a
+// forest expect.
+template <typename Key, typename T, typename Hash = std::hash<Key>, typename Equal = std::equal_to<Key>>
+class hash_table {
+    template <bool Const>
+    class basic_iterator;
+
+public:
+    using key_type = Key;
+    using mapped_type = T;
+    using value_type = std::pair<Key, T>;
+    using size_type = size_t;
+    using hasher = Hash;
+    using key_equal = Equal;
+    using iterator = basic_iterator<false>;
+    using const_iterator = basic_iterator<true>;
+
+    static constexpr bool stable_iterators = false;
+    static constexpr size_type group_size = 16;
+
+    class node_type {
+    public:
+        node_type() = default;
+
+        bool empty() const {
+            return !value_.has_value();
+        }
+
+        explicit operator bool() const {
+            return !empty();
+        }
+
+        key_type& key() const {
+            return value_->first;
+        }
+
+        mapped_type& mapped() const {
+            return value_->second;
+        }
+
+    private:
+        friend class hash_table;
+        mutable std::optional<value_type> value_;
+    };
+
+    struct insert_return_type {
+        iterator position;
+        bool inserted;
+        node_type node;
+    };
+
+    hash_table() : ctrl_(nullptr), slots_(nullptr), capacity_(0), size_(0), growth_left_(0) {}
+
+    hash_table(const hash_table& other) : hash_table() {
+        reserve(other.size());
+        for (const auto& value : other) {
+            insert(value);
+        }
+    }
+
+    hash_table(hash_table&& other) noexcept : hash_table() {
+        swap(other);
+    }
+
+    hash_table& operator=(hash_table other) noexcept {
+        swap(other);
+        return *this;
+    }
+
+    ~hash_table() {
+        destroy();
+    }
+
+    void swap(hash_table& other) noexcept {
+        std::swap(ctrl_, other.ctrl_);
+        std::swap(slots_, other.slots_);
+        std::swap(capacity_, other.capacity_);
+        std::swap(size_, other.size_);
+        std::swap(growth_left_, other.growth_left_);
+        std::swap(hash_, other.hash_);
+        std::swap(equal_, other.equal_);
+    }
+
+    iterator begin() {
+        return iterator(this, 0);
+    }
+
+    iterator end() {
+        return iterator(this, capacity_, true);
+    }
+
+    const_iterator begin() const {
+        return const_iterator(this, 0);
+    }
+
+    const_iterator end() const {
+        return const_iterator(this, capacity_, true);
+    }
+
+    size_type size() const {
+        return size_;
+    }
+
+    bool empty() const {
+        return size_ == 0;
+    }
+
+    hasher hash_function() const {
+        return hash_;
+    }
+
+    key_equal key_eq() const {
+        return equal_;
+    }
+
+    iterator find(const key_type& key) {
+        return iterator(this, find_slot(key), true);
+    }
+
+    const_iterator find(const key_type& key) const {
+        return const_iterator(this, find_slot(key), true);
+    }
+
+    // Lookups by any type the hasher and key_equal both accept, given they
+    // are transparent.
+    template <typename K, typename H = Hash, typename E = Equal,
+        typename = typename H::is_transparent, typename = typename E::is_transparent>
+    iterator find(const K& key) {
+        return iterator(this, find_slot(key), true);
+    }
+
+    std::pair<iterator, bool> insert(const value_type& value) {
+        return insert_unique(value);
+    }
+
+    std::pair<iterator, bool> insert(value_type&& value) {
+        return insert_unique(std::move(value));
+    }
+
+    insert_return_type insert(node_type&& node) {
+        if (node.empty()) {
+            return {end(), false, node_type()};
+        }
+
+        size_type slot = find_slot(node.key());
+        if (slot != capacity_) {
+            return {iterator(this, slot, true), false, std::move(node)};
+        }
+        auto it = insert_new(node.key(), std::move(*node.value_));
+        node.value_.reset();
+        return {it, true, node_type()};
+    }
+
+    // The hint is ignored, as in std::unordered_map.
+    template <typename... Params>
+    iterator emplace_hint(const_iterator, Params&&... params) {
+        return insert_unique(value_type(std::forward<Params>(params)...)).first;
+    }
+
+    node_type extract(const_iterator it) {
+        node_type node;
+        node.value_.emplace(std::move(slots_[it.index_]));
+        erase_slot(it.index_);
+        return node;
+    }
+
+    iterator erase(const_iterator it) {
+        erase_slot(it.index_);
+        return iterator(this, it.index_ + 1);
+    }
+
+    size_type erase(const key_type& key) {
+        size_type slot = find_slot(key);
+        if (slot == capacity_) {
+            return 0;
+        }
+        erase_slot(slot);
+        return 1;
+    }
+
+    void clear() {
+        destroy();
+        ctrl_ = nullptr;
+        slots_ = nullptr;
+        capacity_ = size_ = growth_left_ = 0;
+    }
+
+    // Sizes the table to hold `count` entries without rehashing.
+    void reserve(size_type count) {
+        if (count > max_load(capacity_)) {
+            rehash_to(capacity_for(count));
+        }
+    }
+
+private:
+    static constexpr int8_t empty_ctrl = -128;
+    static constexpr int8_t deleted_ctrl = -2;
+
+    int8_t* ctrl_;
+    value_type* slots_;
+    size_type capacity_;
+    size_type size_;
+    size_type growth_left_;
+    Hash hash_;
+    Equal equal_;
+
+    template <bool Const>
+    class basic_iterator {
+        using table_type = std::conditional_t<Const, const hash_table, hash_table>;
+
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = typename hash_table::value_type;
+        using difference_type = std::ptrdiff_t;
+        using reference = std::conditional_t<Const, const value_type&, value_type&>;
+        using pointer = std::conditional_t<Const, const value_type*, value_type*>;
+
+        basic_iterator() : table_(nullptr), index_(0) {}
+
+        template <bool C = Const, typename = std::enable_if_t<C>>
+        basic_iterator(const basic_iterator<false>& other) : table_(other.table_), index_(other.index_) {}
+
+        reference operator*() const {
+            return table_->slots_[index_];
+        }
+
+        pointer operator->() const {
+            return &table_->slots_[index_];
+        }
+
+        basic_iterator& operator++() {
+            index_++;
+            skip_free();
+            return *this;
+        }
+
+        basic_iterator operator++(int) {
+            auto it = *this;
+            ++*this;
+            return it;
+        }
+
+        bool operator==(const basic_iterator& other) const {
+            return index_ == other.index_;
+        }
+
+        bool operator!=(const basic_iterator& other) const {
+            return !(*this == other);
+        }
+
+    private:
+        friend class hash_table;
+        template <bool>
+        friend class basic_iterator;
+
+        table_type* table_;
+        size_type index_;
+
+        basic_iterator(table_type* table, size_type index, bool exact = false) : table_(table), index_(index) {
+            if (!exact) {
+                skip_free();
+            }
+        }
+
+        void skip_free() {
+            while (index_ < table_->capacity_ && table_->ctrl_[index_] < 0) {
+                index_++;
+            }
+        }
+    };
+
+    // Control bytes of one group, matched 16 at a time.
+    struct group {
+#if defined(__SSE2__)
+        __m128i ctrl;
+
+        explicit group(const int8_t* pointer)
+            : ctrl(_mm_load_si128(reinterpret_cast<const __m128i*>(pointer))) {}
+
+        uint32_t match(int8_t h2) const {
+            return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(h2), ctrl));
+        }
+
+        uint32_t match_empty() const {
+            return match(empty_ctrl);
+        }
+
+        uint32_t match_free() const {
+            return _mm_movemask_epi8(_mm_cmpgt_epi8(_mm_set1_epi8(-1), ctrl));
+        }
+#else
+        const int8_t* ctrl;
+
+        explicit group(const int8_t* pointer) : ctrl(pointer) {}
+
+        uint32_t match(int8_t h2) const {
+            uint32_t mask = 0;
+            for (size_type i = 0; i < group_size; i++) {
+                mask |= uint32_t(ctrl[i] == h2) << i;
+            }
+            return mask;
+        }
+
+        uint32_t match_empty() const {
+            return match(empty_ctrl);
+        }
+
+        uint32_t match_free() const {
+            uint32_t mask = 0;
+            for (size_type i = 0; i < group_size; i++) {
+                mask |= uint32_t(ctrl[i] < 0) << i;
+            }
+            return mask;
+        }
+#endif
+    };
+
+    static size_type max_load(size_type capacity) {
+        return capacity - capacity / 8;
+    }
+
+    static size_type capacity_for(size_type count) {
+        size_type capacity = group_size;
+        while (max_load(capacity) < count) {
+            capacity *= 2;
+        }
+        return capacity;
+    }
+
+    // Integer hashes are often the identity, so spread all bits into both
+    // the control byte (low 7 bits) and the group index (the bits just
+    // above them).
+    template <typename K>
+    size_type hash_of(const K& key) const {
+        uint64_t hash = hash_(key);
+        hash ^= hash >> 33;
+        hash *= 0xff51afd7ed558ccdULL;
+        hash ^= hash >> 33;
+        return hash;
+    }
+
+    // Visits the groups of the probe sequence for `hash` until `visit`
+    // returns true. Triangular steps over a power-of-two number of groups
+    // reach every group.
+    template <typename Visit>
+    void probe(size_type hash, Visit visit) const {
+        size_type mask = capacity_ / group_size - 1;
+        size_type index = (hash >> 7) & mask;
+        for (size_type step = 1; !visit(index * group_size); step++) {
+            index = (index + step) & mask;
+        }
+    }
+
+    template <typename K>
+    size_type find_slot(const K& key) const {
+        if (size_ == 0) {
+            return capacity_;
+        }
+
+        size_type hash = hash_of(key);
+        int8_t h2 = hash & 0x7f;
+        size_type found = capacity_;
+        probe(hash, [&](size_type start) {
+            group g(ctrl_ + start);
+            for (uint32_t matches = g.match(h2); matches != 0; matches &= matches - 1) {
+                size_type slot = start + __builtin_ctz(matches);
+                if (equal_(slots_[slot].first, key)) {
+                    found = slot;
+                    return true;
+                }
+            }
+            return g.match_empty() != 0;
+        });
+        return found;
+    }
+
+    template <typename Value>
+    std::pair<iterator, bool> insert_unique(Value&& value) {
+        size_type slot = find_slot(value.first);
+        if (slot != capacity_) {
+            return {iterator(this, slot, true), false};
+        }
+        return {insert_new(value.first, std::forward<Value>(value)), true};
+    }
+
+    // Inserts a key known to be absent.
+    template <typename Value>
+    iterator insert_new(const key_type& key, Value&& value) {
+        if (growth_left_ == 0) {
+            // Tombstones alone can fill a table: clean them up in place if
+            // that frees enough room, otherwise grow.
+            rehash_to(size_ < max_load(capacity_) / 2 ? capacity_ : capacity_for(size_ + 1));
+        }
+
+        size_type hash = hash_of(key);
+        size_type slot = 0;
+        probe(hash, [&](size_type start) {
+            uint32_t free = group(ctrl_ + start).match_free();
+            if (free != 0) {
+                slot = start + __builtin_ctz(free);
+                return true;
+            }
+            return false;
+        });
+
+        if (ctrl_[slot] == empty_ctrl) {
+            growth_left_--;
+        }
+        new (&slots_[slot]) value_type(std::forward<Value>(value));
+        ctrl_[slot] = hash & 0x7f;
+        size_++;
+        return iterator(this, slot, true);
+    }
+
+    // A slot can be marked empty again if its group has another empty slot:
+    // no probe sequence continued past the group, so none can be cut short.
+    void erase_slot(size_type slot) {
+        slots_[slot].~value_type();
+        size_type start = slot - slot % group_size;
+        if (group(ctrl_ + start).match_empty() != 0) {
+            ctrl_[slot] = empty_ctrl;
+            growth_left_++;
+        } else {
+            ctrl_[slot] = deleted_ctrl;
+        }
+        size_--;
+    }
+
+    void rehash_to(size_type capacity) {
+        hash_table other;
+        other.hash_ = hash_;
+        other.equal_ = equal_;
+        other.allocate(capacity);
+        for (size_type i = 0; i < capacity_; i++) {
+            if (ctrl_[i] >= 0) {
+                const key_type& key = slots_[i].first;
+                other.insert_new(key, std::move(slots_[i]));
+            }
+        }
+        swap(other);
+    }
+
+    void allocate(size_type capacity) {
+        ctrl_ = static_cast<int8_t*>(::operator new(capacity, std::align_val_t(group_size)));
+        std::memset(ctrl_, empty_ctrl, capacity);
+        slots_ = std::allocator<value_type>().allocate(capacity);
+        capacity_ = capacity;
+        growth_left_ = max_load(capacity);
+    }
+
+    void destroy() {
+        if (ctrl_ == nullptr) {
+            return;
+        }
+        for (size_type i = 0; i < capacity_; i++) {
+            if (ctrl_[i] >= 0) {
+                slots_[i].~value_type();
+            }
+        }
+        ::operator delete(ctrl_, std::align_val_t(group_size));
+        std::allocator<value_type>().deallocate(slots_, capacity_);
+    }
+};
+
+}
+
+#endif
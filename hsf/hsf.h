@@ -2,32 +2,260 @@
 #define HSF_HSF_H
 
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <shared_mutex>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
+#include "epoch.h"
+#include "filter.h"
+#include "frozen.h"
+#include "serialize.h"
+#include "stats.h"
+
 namespace hsf {
 
 template <typename Derived>
 struct forest_traits;
 
+// Per-level capacities and their running totals, evaluated once up to the
+// level where they exceed any realistic size and clamped beyond it. With a
+// fixed `Depth`, predictions past the last level map to it.
+template <typename Capacity, size_t Depth = 0>
+class capacity_schedule {
+public:
+    capacity_schedule(const Capacity& capacity) {
+        size_t total = 0;
+        for (size_t level = 0; level < max_levels; level++) {
+            size_t value = capacity(level);
+            if (level > 0 && (value < capacities_.back() || value > limit)) {
+                break;
+            }
+
+            total = std::min(total + value, limit);
+            capacities_.push_back(value);
+            offsets_.push_back(total);
+        }
+    }
+
+    size_t operator()(size_t level) const {
+        return level < capacities_.size() ? capacities_[level] : capacities_.back();
+    }
+
+    // The level whose slice of the cumulative capacity contains `prediction`.
+    size_t level_of(size_t prediction) const {
+        size_t level = std::upper_bound(offsets_.begin(), offsets_.end(), prediction) - offsets_.begin();
+        if (level == offsets_.size()) {
+            level += (prediction - offsets_.back()) / std::max<size_t>(1, capacities_.back());
+        }
+        if constexpr (Depth > 0) {
+            level = std::min(level, Depth - 1);
+        }
+        return level;
+    }
+
+private:
+    static constexpr size_t max_levels = 256;
+    static constexpr size_t limit = size_t(1) << 62;
+
+    std::vector<size_t> capacities_;
+    std::vector<size_t> offsets_;
+};
+
+template <typename Capacity, size_t Depth>
+size_t prediction_to_level(size_t prediction, const capacity_schedule<Capacity, Depth>& schedule) {
+    return schedule.level_of(prediction);
+}
+
+// Level containers whose iterators are invalidated by inserts and erases
+// (e.g. sorted_array) declare `static constexpr bool stable_iterators = false`.
+template <typename Level, typename = void>
+struct has_stable_iterators : std::true_type {};
+
+template <typename Level>
+struct has_stable_iterators<Level, std::void_t<decltype(Level::stable_iterators)>> 
+    : std::bool_constant<Level::stable_iterators> {};
+
+// Level containers with node handles (e.g. std::map) move keys between
+// levels by splicing their nodes instead of reallocating them.
+template <typename Level, typename = void>
+struct has_node_handles : std::false_type {};
+
+template <typename Level>
+struct has_node_handles<Level, std::void_t<typename Level::node_type>> : std::true_type {};
+
+// Level containers without a key_compare (e.g. hash_table) keep keys
+// unordered: forests over them find keys by hash but cannot be traversed in
+// order, frozen or serve hot levels.
+template <typename Level, typename = void>
+struct has_ordered_keys : std::false_type {
+    using key_compare = void;
+};
+
+template <typename Level>
+struct has_ordered_keys<Level, std::void_t<typename Level::key_compare>> : std::true_type {
+    using key_compare = typename Level::key_compare;
+};
+
+// Passed as the Key of a forest to store a payload of type T with every key,
+// as in std::map. Each payload is allocated once, so moving its key between
+// levels only moves a pointer.
+template <typename Key, typename T>
+struct mapped {};
+
+// Level entry of a mapped forest: the forest's metadata for the key and the
+// key's payload.
+template <typename Metadata, typename T>
+struct mapped_entry {
+    Metadata metadata;
+    std::unique_ptr<T> payload;
+
+    T& value() const {
+        return *payload;
+    }
+};
+
+template <typename Key>
+struct key_traits {
+    using key_type = Key;
+    using mapped_type = void;
+
+    template <typename Metadata>
+    using entry_type = Metadata;
+};
+
+template <typename Key, typename T>
+struct key_traits<mapped<Key, T>> {
+    using key_type = Key;
+    using mapped_type = T;
+
+    template <typename Metadata>
+    using entry_type = mapped_entry<Metadata, T>;
+};
+
+struct null_mutex {
+    void lock() {}
+    bool try_lock() { return true; }
+    void unlock() {}
+    void lock_shared() {}
+    bool try_lock_shared() { return true; }
+    void unlock_shared() {}
+};
+
+// Policies select how a forest synchronizes access to its levels. Each level
+// (container and metadata) is guarded by its own reader/writer lock; writers
+// acquire levels in ascending order, so cascades towards the bottom never
+// block operations confined to the levels above them.
+struct single_threaded {
+    using mutex_type = null_mutex;
+    using stats_type = null_stats;
+    static constexpr size_t max_levels = 0;
+    static constexpr size_t hot_levels = 0;
+    static constexpr size_t fixed_levels = 0;
+
+    template <typename Key>
+    using filter_type = null_filter<Key>;
+};
+
+struct level_locking {
+    using mutex_type = std::shared_mutex;
+    using stats_type = null_stats;
+    static constexpr size_t max_levels = 64;
+    static constexpr size_t hot_levels = 0;
+    static constexpr size_t fixed_levels = 0;
+
+    template <typename Key>
+    using filter_type = null_filter<Key>;
+};
+
+// Additionally publishes the first hot_levels levels as immutable snapshots,
+// reclaimed by epochs, so hits there are served without taking any lock. 
+// Frequency updates from such hits are sampled once every hit_sampling hits
+// and folded into the level metadata by the next writer.
+struct epoch_reclaimed : level_locking {
+    static constexpr size_t hot_levels = 2;
+    static constexpr uint32_t hit_sampling = 16;
+};
+
+// Keeps an approximate-membership filter per level, so lookups skip the
+// containers of levels that cannot hold the key.
+struct bloom_filtered : single_threaded {
+    template <typename Key>
+    using filter_type = counting_bloom_filter<Key>;
+};
+
+// Adds per-level telemetry (see stats.h) to any other policy, e.g.
+// with_stats<level_locking>.
+template <typename Policy>
+struct with_stats : Policy {
+    using stats_type = level_stats;
+};
+
+// Gives the forests of any other policy exactly `Levels` levels, e.g.
+// fixed_depth<4, level_locking>, for key counts known at build time. The
+// levels are held in a std::array, lookups are unrolled over them, and the
+// bottom level takes every key the levels above overflow.
+template <size_t Levels, typename Policy>
+struct fixed_depth : Policy {
+    static_assert(Levels > 0 && (Policy::max_levels == 0 || Levels <= Policy::max_levels),
+        "fixed_depth: too many levels for the policy");
+    static constexpr size_t max_levels = Policy::max_levels == 0 ? 0 : Levels;
+    static constexpr size_t fixed_levels = Levels;
+};
+
 template <typename Derived>
 class search_forest {
 public:
     using level_type = typename forest_traits<Derived>::level_type;
     using capacity_type = typename forest_traits<Derived>::capacity_type;
+    using policy_type = typename forest_traits<Derived>::policy_type;
+    using mutex_type = typename policy_type::mutex_type;
+    using stats_type = typename policy_type::stats_type;
+    using metadata_type = typename forest_traits<Derived>::metadata_type;
+    using mapped_type = typename forest_traits<Derived>::mapped_type;
     using key_type = typename level_type::key_type;
+    using filter_type = typename policy_type::template filter_type<key_type>;
     using value_type = typename level_type::value_type;
     using size_type = typename level_type::size_type;
     using level_iterator = typename level_type::iterator;
+    using frozen_type = frozen_forest<key_type, mapped_type, typename has_ordered_keys<level_type>::key_compare>;
+
+    static constexpr bool concurrent = !std::is_same_v<mutex_type, null_mutex>;
+    static constexpr bool is_map = !std::is_void_v<mapped_type>;
+    static constexpr size_type hot_levels = policy_type::hot_levels;
+    static constexpr size_type fixed_levels = policy_type::fixed_levels;
+    static constexpr bool stable_iterators = has_stable_iterators<level_type>::value;
+    static constexpr bool ordered_levels = has_ordered_keys<level_type>::value;
 
+    static_assert(hot_levels == 0 || (concurrent && hot_levels <= policy_type::max_levels),
+        "hot levels require a concurrent policy");
+    static_assert(hot_levels == 0 || ordered_levels, "hot levels require ordered levels");
+
+    // In concurrent forests an iterator only reliably identifies the level a
+    // key was found in: dereferencing it races with later moves, and one 
+    // served from a hot level snapshot cannot be dereferenced at all.
     struct iterator {
     public:
-        value_type& operator*() { 
+        decltype(auto) operator*() { 
             return *iter_; 
         }
         
-        value_type* operator->() { 
-            return &(*iter_); 
+        decltype(auto) operator->() { 
+            return iter_.operator->(); 
         }
 
         bool operator==(const iterator& other) const {
@@ -51,9 +279,115 @@ public:
             : iter_(iter), level_(level) {}
     };
 
+    // Visits keys in order across levels by merging one cursor per level in
+    // a min-heap. Ordered reads are not accesses and never move keys; in 
+    // concurrent forests they must not overlap with writers (see scan).
+    class ordered_iterator {
+        static_assert(ordered_levels, "search_forest: ordered traversal requires ordered levels");
+
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = typename search_forest::value_type;
+        using difference_type = std::ptrdiff_t;
+
+        ordered_iterator() = default;
+
+        decltype(auto) operator*() const {
+            return *heap_.front().iter;
+        }
+
+        decltype(auto) operator->() const {
+            return heap_.front().iter.operator->();
+        }
+
+        ordered_iterator& operator++() {
+            std::pop_heap(heap_.begin(), heap_.end(), greater());
+            auto& next = heap_.back();
+            if (++next.iter == next.end) {
+                heap_.pop_back();
+            } else {
+                std::push_heap(heap_.begin(), heap_.end(), greater());
+            }
+            return *this;
+        }
+
+        ordered_iterator operator++(int) {
+            auto it = *this;
+            ++*this;
+            return it;
+        }
+
+        bool operator==(const ordered_iterator& other) const {
+            if (heap_.empty() || other.heap_.empty()) {
+                return heap_.empty() == other.heap_.empty();
+            }
+            return heap_.front().level == other.heap_.front().level && heap_.front().iter == other.heap_.front().iter;
+        }
+
+        bool operator!=(const ordered_iterator& other) const {
+            return !(*this == other);
+        }
+
+        size_type level() const {
+            return heap_.front().level;
+        }
+
+        // The point iterator to the current key, e.g. to erase it.
+        iterator base() const {
+            return iterator(heap_.front().iter, heap_.front().level);
+        }
+
+    private:
+        friend class search_forest;
+
+        struct cursor {
+            level_iterator iter;
+            level_iterator end;
+            size_type level;
+        };
+
+        std::vector<cursor> heap_;
+        typename level_type::key_compare compare_;
+
+        auto greater() const {
+            return [this](const cursor& left, const cursor& right) {
+                return compare_(right.iter->first, left.iter->first);
+            };
+        }
+
+        template <typename Start>
+        ordered_iterator(search_forest& forest, Start start) {
+            for (size_type i = 0; i < forest.levels(); i++) {
+                auto& level = forest.levels_[i];
+                auto iter = start(level);
+                if (iter != level.end()) {
+                    heap_.push_back({iter, level.end(), i});
+                }
+            }
+            std::make_heap(heap_.begin(), heap_.end(), greater());
+        }
+    };
+
     explicit search_forest(capacity_type min_capacity, capacity_type max_capacity)
-        : min_capacity_(min_capacity), max_capacity_(max_capacity), total_size_(0) {
-        levels_.emplace_back();
+        : min_capacity_(min_capacity), max_capacity_(max_capacity), 
+          locks_(policy_type::max_levels), total_size_(0), level_count_(1) {
+        if constexpr (fixed_levels > 0) {
+            level_count_ = fixed_levels;
+        } else if constexpr (concurrent) {
+            levels_.resize(policy_type::max_levels);
+            filters_.resize(policy_type::max_levels);
+        } else {
+            levels_.emplace_back();
+            filters_.emplace_back();
+        }
+    }
+
+    ~search_forest() {
+        if constexpr (hot_levels > 0) {
+            for (auto& snapshot : snapshots_) {
+                delete snapshot.load();
+            }
+        }
     }
 
     size_type size() const {
@@ -67,46 +401,137 @@ public:
         return levels_[level].size();
     }
 
+    // The bottom level of a fixed-depth forest has no maximum.
     std::pair<size_type, size_type> capacity(size_type level) const {
+        if (fixed_levels > 0 && level + 1 >= fixed_levels) {
+            return std::make_pair(min_capacity_(level), std::numeric_limits<size_type>::max());
+        }
         return std::make_pair(min_capacity_(level), max_capacity_(level));
     }
     
     size_type levels() const {
-        return levels_.size();
+        if constexpr (fixed_levels > 0) {
+            return fixed_levels;
+        } else {
+            return level_count_;
+        }
     }
 
-    iterator find(const key_type& key, size_type hint) {
-        for (size_type i = hint; i < levels_.size(); i++) {
-            auto it = levels_[i].find(key);
-            if (it != levels_[i].end()) {
-#ifdef HSF_DEBUG
-                if (i != hint) {
-                    mispredictions_++;
-                }
-#endif
-                return iterator(it, i);
+    const stats_type& stats() const {
+        return stats_;
+    }
+
+    // Moves compaction off the operations of a concurrent forest: levels
+    // that overflow or underflow their capacities are only marked, and a
+    // background thread restores them, moving at most `chunk` keys per
+    // locking so that operations interleave with long cascades. An operation
+    // still compacts a level itself once its size is more than `slack` times
+    // the violated capacity away from it, bounding the drift. Not safe to
+    // call concurrently.
+    void start_compaction(double slack, size_type chunk = 64) {
+        static_assert(concurrent, "background compaction requires a concurrent policy");
+        stop_compaction();
+        compactor_ = std::make_unique<compactor>();
+        compactor_->slack = slack;
+        compactor_->chunk = std::max<size_type>(chunk, 1);
+        compactor_->thread = std::thread([this] {
+            run_compactor();
+        });
+    }
+
+    // Deamortizes compaction in a single-threaded forest: each operation
+    // moves at most `moves` keys between levels besides the key it accesses,
+    // first finishing compactions earlier operations left pending, deepest
+    // level first. Levels stay within their capacities as long as `moves`
+    // exceeds the amortized moves per operation, about one per level.
+    void set_move_budget(size_type moves) {
+        static_assert(!concurrent, "concurrent forests compact with start_compaction");
+        move_budget_ = moves;
+    }
+
+    // Replaces the capacities, e.g. with those a capacity_tuner derives from
+    // the forest's hits, and reshapes the levels top-down: a level above its
+    // new maximum is compacted, and one below its new minimum takes the
+    // keys the level below ranks highest. Single-threaded forests with a
+    // move budget reshape a few keys per operation; others reshape at once,
+    // holding every level. Learned forests leave their keys where they are,
+    // to be found by searching outward, and place new keys by the new
+    // capacities. Not safe to call concurrently.
+    void reshape(capacity_type min_capacity, capacity_type max_capacity) {
+        if constexpr (concurrent) {
+            level_guard guard(*this);
+            for (size_type level = 0; level < levels(); level++) {
+                guard.acquire(level);
+            }
+
+            min_capacity_ = min_capacity;
+            max_capacity_ = max_capacity;
+            for (size_type level = 0; level < levels(); level++) {
+                static_cast<Derived&>(*this).reshape_level(level, guard);
+                trim();
             }
+        } else {
+            min_capacity_ = min_capacity;
+            max_capacity_ = max_capacity;
+            reshaping_ = 0;
+            resume_compaction();
         }
-        return end();
     }
 
-    iterator insert(const value_type& value, size_type level) {
-        while (level >= levels_.size()) {
-            levels_.emplace_back();
+    // Stops the background thread once it has rebalanced every marked level.
+    // Forests stop it before destroying their metadata.
+    void stop_compaction() {
+        if (compactor_ == nullptr) {
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(compactor_->mutex);
+            compactor_->stopping = true;
         }
+        compactor_->wake.notify_one();
+        compactor_->thread.join();
+        compactor_.reset();
+    }
+
+    // Lookups take a key_type or, if the level comparator is transparent (e.g.
+    // std::less<>), any type it compares with keys, such as std::string_view.
+    template <typename K>
+    iterator find(const K& key, size_type hint) {
+        auto it = locate(key, hint);
+        record_lookup(it);
+        return it;
+    }
+
+    std::vector<iterator> find_batch(const std::vector<key_type>& keys, size_type hint) {
+        return find_batch(keys, std::vector<size_type>(keys.size(), hint));
+    }
+
+    std::vector<iterator> find_batch(const std::vector<key_type>& keys, const std::vector<size_type>& hints) {
+        return lookup_batch(keys, hints, false);
+    }
+
+    iterator insert(value_type value, size_type level) {
+        grow(level);
         
-        auto it = levels_[level].insert(value).first;
+        auto [it, inserted] = levels_[level].insert(std::move(value));
+        if (inserted) {
+            filter_insert(level, it->first);
+            total_size_++;
+        }
+        mark_dirty(level);
 #ifdef HSF_DEBUG
         if (levels_[level].size() > max_capacity_(level)) {
             compactions_++;
         }
 #endif
-        total_size_++;
         return iterator(it, level);
     }
 
     void erase(iterator it) {
+        filters_[it.level_].erase(filter_type::hash(it->first));
         levels_[it.level_].erase(it.iter_);
+        mark_dirty(it.level_);
 #ifdef HSF_DEBUG
         if (levels_[it.level_].size() < min_capacity_(it.level_)) {
             promotions_++;
@@ -128,6 +553,102 @@ public:
         return iterator({}, size_type(-1));
     }
 
+    ordered_iterator ordered_begin() {
+        return ordered_iterator(*this, [](level_type& level) {
+            return level.begin();
+        });
+    }
+
+    ordered_iterator ordered_end() {
+        return ordered_iterator();
+    }
+
+    ordered_iterator lower_bound(const key_type& key) {
+        return ordered_iterator(*this, [&](level_type& level) {
+            return level.lower_bound(key);
+        });
+    }
+
+    ordered_iterator upper_bound(const key_type& key) {
+        return ordered_iterator(*this, [&](level_type& level) {
+            return level_upper_bound(level, key);
+        });
+    }
+
+    std::pair<ordered_iterator, ordered_iterator> equal_range(const key_type& key) {
+        return {lower_bound(key), upper_bound(key)};
+    }
+
+    // The smallest key greater than `key`, or end().
+    iterator successor(const key_type& key) {
+        static_assert(ordered_levels, "search_forest: successor requires ordered levels");
+        typename level_type::key_compare compare;
+        iterator best = end();
+        for (size_type i = 0; i < levels(); i++) {
+            std::shared_lock<mutex_type> lock(level_mutex(i));
+            auto it = level_upper_bound(levels_[i], key);
+            if (it != levels_[i].end() && (best == end() || compare(it->first, best->first))) {
+                best = iterator(it, i);
+            }
+        }
+        return best;
+    }
+
+    // The largest key less than `key`, or end().
+    iterator predecessor(const key_type& key) {
+        static_assert(ordered_levels, "search_forest: predecessor requires ordered levels");
+        typename level_type::key_compare compare;
+        iterator best = end();
+        for (size_type i = 0; i < levels(); i++) {
+            std::shared_lock<mutex_type> lock(level_mutex(i));
+            auto it = levels_[i].lower_bound(key);
+            if (it != levels_[i].begin() && (best == end() || compare(best->first, std::prev(it)->first))) {
+                best = iterator(std::prev(it), i);
+            }
+        }
+        return best;
+    }
+
+    // Calls `visit` on every entry with a key in [first, last), in order, in
+    // one pass over the forest. Holds every level's shared lock throughout,
+    // so `visit` must not call back into the forest.
+    template <typename Visit>
+    void scan(const key_type& first, const key_type& last, Visit visit) {
+        std::vector<std::shared_lock<mutex_type>> locks;
+        for (size_type i = 0; i < levels(); i++) {
+            locks.emplace_back(level_mutex(i));
+        }
+
+        typename level_type::key_compare compare;
+        for (auto it = lower_bound(first); it != ordered_end() && compare(it->first, last); ++it) {
+            visit(*it);
+        }
+    }
+
+    // Writes an immutable image of the levels and capacity schedule, to be
+    // served by frozen_type from a file holding only the image. Keys and
+    // payloads must be trivially copyable. Holds every level's shared lock.
+    void freeze(std::ostream& out) const {
+        static_assert(ordered_levels, "search_forest: freeze requires ordered levels");
+        std::vector<std::shared_lock<mutex_type>> locks;
+        std::vector<frozen_level> table(levels());
+        for (size_type i = 0; i < levels(); i++) {
+            locks.emplace_back(level_mutex(i));
+            table[i].size = levels_[i].size();
+            table[i].min_capacity = min_capacity_(i);
+            table[i].max_capacity = max_capacity_(i);
+        }
+
+        write_frozen<key_type, mapped_type>(out, std::move(table), [&](size_type level, auto& keys, auto& values) {
+            for (const auto& value : levels_[level]) {
+                keys.push_back(value.first);
+                if constexpr (is_map) {
+                    values.push_back(value.second.value());
+                }
+            }
+        });
+    }
+
 #ifdef HSF_DEBUG
     mutable size_type compactions_ = 0;
     mutable size_type promotions_ = 0;
@@ -135,10 +656,1172 @@ public:
 #endif
 
 protected:
-    [[no_unique_address]] capacity_type min_capacity_;
-    [[no_unique_address]] capacity_type max_capacity_;
-    std::vector<level_type> levels_;
-    size_type total_size_;
+    template <typename T>
+    using counter_type = std::conditional_t<concurrent, std::atomic<T>, T>;
+
+    // Exclusive locks held by one operation. Levels below every held level
+    // are locked in order; others are only tried, since waiting on them could
+    // deadlock against a cascade coming from above. An operation may also be
+    // allowed only so many key moves, after which compactions stop early.
+    class level_guard {
+    public:
+        explicit level_guard(search_forest& forest, size_type moves = std::numeric_limits<size_type>::max()) 
+            : forest_(forest), held_(0), moves_(moves) {}
+
+        level_guard(const level_guard&) = delete;
+        level_guard& operator=(const level_guard&) = delete;
+
+        ~level_guard() {
+            forest_.stats_.end_operation();
+            if constexpr (concurrent) {
+                for (size_type level = 0; held_ != 0; level++) {
+                    if (held_ & (uint64_t(1) << level)) {
+                        forest_.publish(level);
+                        forest_.locks_[level].unlock();
+                        held_ &= ~(uint64_t(1) << level);
+                    }
+                }
+            }
+        }
+
+        bool acquire(size_type level) {
+            if constexpr (concurrent) {
+                if (level >= forest_.locks_.size()) {
+                    throw std::length_error("search_forest: too many levels");
+                }
+
+                uint64_t bit = uint64_t(1) << level;
+                if (held_ & bit) {
+                    return true;
+                } else if (held_ > bit) {
+                    if (!forest_.locks_[level].try_lock()) {
+                        return false;
+                    }
+                } else {
+                    forest_.locks_[level].lock();
+                }
+                held_ |= bit;
+            }
+            return true;
+        }
+
+        // Takes one of the operation's moves, if any are left.
+        bool spend() {
+            if (moves_ == 0) {
+                exhausted_ = true;
+                return false;
+            }
+            moves_--;
+            return true;
+        }
+
+        // Takes up to `moves` of the operation's moves and returns how many
+        // were left to take.
+        size_type spend(size_type moves) {
+            if (moves > moves_) {
+                exhausted_ = true;
+                moves = moves_;
+            }
+            moves_ -= moves;
+            return moves;
+        }
+
+        // Allows the operation only `moves` more key moves.
+        void restrict(size_type moves) {
+            moves_ = moves;
+        }
+
+        // Whether a compaction stopped for lack of moves.
+        bool exhausted() const {
+            return exhausted_;
+        }
+
+        size_type moves() const {
+            return moves_;
+        }
+
+        // Whether the operation holds `level`; always in single-threaded
+        // forests.
+        bool holds(size_type level) const {
+            if constexpr (concurrent) {
+                return held_ & (uint64_t(1) << level);
+            }
+            return true;
+        }
+
+    private:
+        search_forest& forest_;
+        uint64_t held_;
+        size_type moves_;
+        bool exhausted_ = false;
+    };
+
+    struct level_snapshot {
+        std::vector<key_type> keys;
+        std::unique_ptr<std::atomic<uint32_t>[]> hits;
+    };
+
+    mutex_type& level_mutex(size_type level) const {
+        if constexpr (concurrent) {
+            return locks_[level];
+        } else {
+            static null_mutex mutex;
+            return mutex;
+        }
+    }
+
+    // Distinct keys of a batch, in sorted order if levels are ordered, with
+    // their multiplicities, the smallest hint given for each and the position
+    // of every input key.
+    struct key_batch {
+        std::vector<key_type> keys;
+        std::vector<size_type> counts;
+        std::vector<size_type> hints;
+        std::vector<size_type> positions;
+    };
+
+    key_batch make_batch(const std::vector<key_type>& keys, const std::vector<size_type>& hints) const {
+        key_batch batch;
+        batch.positions.resize(keys.size());
+        auto add = [&](size_type i, bool distinct) {
+            if (distinct) {
+                batch.keys.push_back(keys[i]);
+                batch.counts.push_back(0);
+                batch.hints.push_back(hints[i]);
+            }
+            batch.counts.back()++;
+            batch.hints.back() = std::min(batch.hints.back(), hints[i]);
+            batch.positions[i] = batch.keys.size() - 1;
+        };
+
+        if constexpr (ordered_levels) {
+            typename level_type::key_compare compare;
+            std::vector<size_type> order(keys.size());
+            std::iota(order.begin(), order.end(), 0);
+            std::stable_sort(order.begin(), order.end(), [&](size_type left, size_type right) {
+                return compare(keys[left], keys[right]);
+            });
+
+            for (size_type i : order) {
+                add(i, batch.keys.empty() || compare(batch.keys.back(), keys[i]));
+            }
+        } else {
+            // Counts and hints accumulate on the back entry, so group
+            // repeats of a key together first.
+            std::unordered_map<key_type, size_type, typename level_type::hasher, typename level_type::key_equal> first;
+            std::vector<std::vector<size_type>> repeats;
+            for (size_type i = 0; i < keys.size(); i++) {
+                auto [it, inserted] = first.emplace(keys[i], repeats.size());
+                if (inserted) {
+                    repeats.emplace_back();
+                }
+                repeats[it->second].push_back(i);
+            }
+            for (const auto& group : repeats) {
+                for (size_type j = 0; j < group.size(); j++) {
+                    add(group[j], j == 0);
+                }
+            }
+        }
+        return batch;
+    }
+
+    // Finds sorted, distinct keys, each starting at its hint, with one ordered
+    // sweep per level. Levels much larger than the number of keys still 
+    // pending, and unordered levels, are probed per key instead.
+    std::vector<iterator> locate_batch(const std::vector<key_type>& keys, const std::vector<size_type>& hints, bool shared) {
+        std::vector<iterator> found(keys.size(), end());
+        std::vector<size_type> pending(keys.size());
+        std::iota(pending.begin(), pending.end(), 0);
+
+        std::vector<uint64_t> hashes(keys.size());
+        for (size_type k = 0; k < keys.size(); k++) {
+            hashes[k] = filter_type::hash(keys[k]);
+        }
+
+        size_type first = hints.empty() ? levels() : *std::min_element(hints.begin(), hints.end());
+        for (size_type i = first; i < levels() && !pending.empty(); i++) {
+            std::shared_lock<mutex_type> lock;
+            if (shared) {
+                lock = std::shared_lock<mutex_type>(level_mutex(i));
+            }
+
+            auto& level = levels_[i];
+            bool sweep = ordered_levels && level.size() <= pending.size() * std::log2(level.size() + 1);
+            auto it = level.begin();
+            size_type remaining = 0;
+            for (size_type k : pending) {
+                if (hints[k] > i || !filters_[i].contains(hashes[k])) {
+                    pending[remaining++] = k;
+                    continue;
+                }
+
+                bool match;
+                if constexpr (ordered_levels) {
+                    typename level_type::key_compare compare;
+                    if (sweep) {
+                        while (it != level.end() && compare(it->first, keys[k])) {
+                            ++it;
+                        }
+                    } else {
+                        it = level.lower_bound(keys[k]);
+                    }
+                    match = it != level.end() && !compare(keys[k], it->first);
+                } else {
+                    it = level.find(keys[k]);
+                    match = it != level.end();
+                }
+
+                if (match) {
+#ifdef HSF_DEBUG
+                    if (i != hints[k]) {
+                        mispredictions_++;
+                    }
+#endif
+                    found[k] = iterator(it, i);
+                } else {
+                    pending[remaining++] = k;
+                }
+            }
+            pending.resize(remaining);
+        }
+        return found;
+    }
+
+    std::vector<iterator> scatter(const key_batch& batch, const std::vector<iterator>& found) const {
+        std::vector<iterator> results;
+        results.reserve(batch.positions.size());
+        for (size_type position : batch.positions) {
+            results.push_back(found[position]);
+        }
+        return results;
+    }
+
+    // Looks up a batch from the given hints and, if `around`, also above
+    // them, as locate_around does for single keys.
+    std::vector<iterator> lookup_batch(const std::vector<key_type>& keys, const std::vector<size_type>& hints, bool around) {
+        auto batch = make_batch(keys, hints);
+        while (true) {
+            size_type upward_moves = upward_moves_;
+            auto found = locate_batch(batch.keys, batch.hints, true);
+            if (around) {
+                locate_above(batch, found, true);
+            }
+            if (upward_moves == upward_moves_) {
+                record_lookups(batch, found);
+                return scatter(batch, found);
+            }
+        }
+    }
+
+    // Finds a key without recording the lookup, for operations that may
+    // repeat it; they record the final outcome with record_lookup.
+    template <typename K>
+    iterator locate(const K& key, size_type hint) {
+        uint64_t hash = filter_type::hash(key);
+        while (true) {
+            size_type upward_moves = upward_moves_;
+            if constexpr (fixed_levels > 0) {
+                auto it = probe_from(key, hash, hint, std::make_index_sequence<fixed_levels>());
+                if (it != end()) {
+#ifdef HSF_DEBUG
+                    if (it.level() != hint) {
+                        mispredictions_++;
+                    }
+#endif
+                    return it;
+                }
+            } else {
+                for (size_type i = hint; i < levels(); i++) {
+                    auto it = probe(key, hash, i, true);
+                    if (it != end()) {
+#ifdef HSF_DEBUG
+                        if (i != hint) {
+                            mispredictions_++;
+                        }
+#endif
+                        return it;
+                    }
+                }
+            }
+
+            // A key promoted past this scan may have been missed.
+            if (upward_moves == upward_moves_) {
+                return end();
+            }
+        }
+    }
+
+    // Finds a key by probing the levels nearest a predicted one first,
+    // alternating shallower and deeper, so a prediction off by d levels
+    // costs at most 2d + 1 probes and keys above it are not missed.
+    template <typename K>
+    iterator locate_around(const K& key, size_type center) {
+        uint64_t hash = filter_type::hash(key);
+        size_type count = levels();
+        if (count == 0) {
+            return end();
+        }
+
+        center = std::min(center, count - 1);
+        size_type span = std::max(center, count - 1 - center);
+        for (size_type distance = 0; distance <= span; distance++) {
+            // Past level 0, `center - distance` wraps around to above `count`.
+            for (size_type i : {center - distance, center + distance}) {
+                if (i < count) {
+                    auto it = probe(key, hash, i, true);
+                    if (it != end()) {
+#ifdef HSF_DEBUG
+                        if (i != center) {
+                            mispredictions_++;
+                        }
+#endif
+                        return it;
+                    }
+                }
+                if (distance == 0) {
+                    break;
+                }
+            }
+        }
+
+        // Keys may have moved past the probes in either direction.
+        if constexpr (concurrent) {
+            return locate(key, 0);
+        }
+        return end();
+    }
+
+    // Searches the levels above each key's hint for the keys of a batch
+    // that a pass from the hints missed.
+    void locate_above(const key_batch& batch, std::vector<iterator>& found, bool shared) {
+        for (size_type k = 0; k < found.size(); k++) {
+            if (found[k] != end() || batch.hints[k] == 0) {
+                continue;
+            }
+
+            if constexpr (concurrent) {
+                if (shared) {
+                    found[k] = locate(batch.keys[k], 0);
+                    continue;
+                }
+            }
+
+            uint64_t hash = filter_type::hash(batch.keys[k]);
+            for (size_type i = 0; i < batch.hints[k] && i < levels() && found[k] == end(); i++) {
+                found[k] = probe(batch.keys[k], hash, i, shared);
+            }
+        }
+    }
+
+    template <typename K>
+    iterator probe(const K& key, uint64_t hash, size_type level, bool shared) {
+        std::shared_lock<mutex_type> lock;
+        if (shared) {
+            lock = std::shared_lock<mutex_type>(level_mutex(level));
+        }
+        if (!filters_[level].contains(hash)) {
+            return end();
+        }
+
+        auto it = levels_[level].find(key);
+        return it != levels_[level].end() ? iterator(it, level) : end();
+    }
+
+    // Probes levels [hint, fixed_levels) in order, unrolled over the fixed
+    // levels so that each probe indexes its level at compile time.
+    template <typename K, size_t... Levels>
+    iterator probe_from(const K& key, uint64_t hash, size_type hint, std::index_sequence<Levels...>) {
+        iterator it = end();
+        ((Levels >= hint && (it = probe(key, hash, Levels, true)) != end()) || ...);
+        return it;
+    }
+
+    void record_lookup(iterator it) const {
+        if (it == end()) {
+            stats_.miss();
+        } else {
+            stats_.hit(it.level());
+        }
+    }
+
+    // Records the outcome of every key of a batch where it was first found.
+    void record_lookups(const key_batch& batch, const std::vector<iterator>& found) const {
+        if constexpr (stats_type::enabled) {
+            for (size_type position : batch.positions) {
+                if (found[position] == end()) {
+                    stats_.miss();
+                } else {
+                    stats_.hit(found[position].level());
+                }
+            }
+        }
+    }
+
+    // Splits n items into levels by rank: each level takes the minimum 
+    // capacity of the best remaining items until the rest fits within its
+    // maximum capacity. Returns every level's items in their input order.
+    template <typename Better>
+    std::vector<std::vector<size_type>> partition_levels(size_type n, Better better) const {
+        std::vector<size_type> order(n);
+        std::iota(order.begin(), order.end(), 0);
+        std::vector<size_type> item_levels(n);
+
+        size_type begin = 0;
+        size_type level = 0;
+        while (true) {
+            auto [min_cap, max_cap] = capacity(level);
+            if (n - begin <= max_cap) {
+                for (size_type i = begin; i < n; i++) {
+                    item_levels[order[i]] = level;
+                }
+                break;
+            }
+
+            std::nth_element(order.begin() + begin, order.begin() + begin + min_cap, order.end(), better);
+            for (size_type i = begin; i < begin + min_cap; i++) {
+                item_levels[order[i]] = level;
+            }
+            begin += min_cap;
+            level++;
+        }
+
+        std::vector<std::vector<size_type>> buckets(level + 1);
+        for (size_type i = 0; i < n; i++) {
+            buckets[item_levels[i]].push_back(i);
+        }
+        return buckets;
+    }
+
+    // Fills the empty levels [0, count) with the values returned by 
+    // build(level), building independent levels on separate threads if 
+    // requested. Values sorted by key are inserted in linear time.
+    template <typename Build>
+    void build_levels(size_type count, Build build, bool parallel) {
+        if (count == 0) {
+            return;
+        }
+
+        grow(count - 1);
+        std::vector<size_type> sizes(count);
+        auto build_level = [&](size_type level) {
+            auto values = build(level);
+            auto& container = levels_[level];
+            if constexpr (ordered_levels) {
+                typename level_type::key_compare compare;
+                std::vector<size_type> order(values.size());
+                std::iota(order.begin(), order.end(), 0);
+                auto by_key = [&](size_type left, size_type right) {
+                    return compare(values[left].first, values[right].first);
+                };
+                if (!std::is_sorted(order.begin(), order.end(), by_key)) {
+                    std::sort(order.begin(), order.end(), by_key);
+                }
+
+                for (size_type i : order) {
+                    container.emplace_hint(container.end(), std::move(values[i]));
+                }
+            } else {
+                container.reserve(values.size());
+                for (auto& value : values) {
+                    container.insert(std::move(value));
+                }
+            }
+            rebuild_filter(level);
+            sizes[level] = container.size();
+        };
+
+        if (parallel) {
+            std::vector<std::thread> threads;
+            for (size_type level = 0; level < count; level++) {
+                threads.emplace_back(build_level, level);
+            }
+            for (auto& thread : threads) {
+                thread.join();
+            }
+        } else {
+            for (size_type level = 0; level < count; level++) {
+                build_level(level);
+            }
+        }
+
+        level_guard guard(*this);
+        for (size_type level = 0; level < count; level++) {
+            guard.acquire(level);
+            mark_dirty(level);
+            total_size_ += sizes[level];
+        }
+        reweigh();
+    }
+
+    // Re-finds a key whose level has since been restructured. Compaction 
+    // only moves keys downwards, so the search starts at the iterator's level.
+    template <typename K>
+    iterator refresh(iterator it, const K& key) {
+        if constexpr (stable_iterators) {
+            return it;
+        } else {
+            return find_from(key, it.level_);
+        }
+    }
+
+    // Holds every level, so that no key is inserted, moved or erased until
+    // the guard is released, e.g. between a failed lookup and an insert.
+    void acquire_all(level_guard& guard) {
+        for (size_type level = 0; level < levels(); level++) {
+            guard.acquire(level);
+        }
+    }
+
+    // Finds a key at or below `level` without taking locks.
+    template <typename K>
+    iterator find_from(const K& key, size_type level) {
+        for (size_type i = level; i < levels(); i++) {
+            auto found = find_in_level(key, i);
+            if (found != end()) {
+                return found;
+            }
+        }
+        return end();
+    }
+
+    static level_iterator level_upper_bound(level_type& level, const key_type& key) {
+        typename level_type::key_compare compare;
+        auto it = level.lower_bound(key);
+        if (it != level.end() && !compare(key, it->first)) {
+            ++it;
+        }
+        return it;
+    }
+
+    template <typename K>
+    iterator find_in_level(const K& key, size_type level) {
+        if (level >= levels()) {
+            return end();
+        }
+
+        auto it = levels_[level].find(key);
+        if (it == levels_[level].end()) {
+            return end();
+        }
+        return iterator(it, level);
+    }
+
+    // Probes the snapshots of hot levels [hint, last) without taking locks.
+    template <typename K>
+    iterator find_hot(const K& key, size_type hint, size_type last, bool record_hits) const {
+        if constexpr (hot_levels > 0) {
+            typename level_type::key_compare compare;
+            auto pin = epochs_.pin();
+            for (size_type i = hint; i < std::min(last, hot_levels); i++) {
+                const level_snapshot* snapshot = snapshots_[i].load(std::memory_order_acquire);
+                if (snapshot == nullptr) {
+                    continue;
+                }
+
+                const auto& keys = snapshot->keys;
+                auto it = std::lower_bound(keys.begin(), keys.end(), key, compare);
+                if (it != keys.end() && !compare(key, *it)) {
+                    if (record_hits) {
+                        record_hit(snapshot->hits[it - keys.begin()]);
+                    }
+                    stats_.hit(i);
+                    return iterator({}, i);
+                }
+            }
+        }
+        return end();
+    }
+
+    // Passes hits recorded by lock-free readers of a hot level to `apply`.
+    // Requires the level to be locked exclusively.
+    template <typename Apply>
+    void drain_hits(size_type level, Apply apply) {
+        if constexpr (hot_levels > 0) {
+            level_snapshot* snapshot = level < hot_levels ? snapshots_[level].load() : nullptr;
+            if (snapshot == nullptr) {
+                return;
+            }
+
+            for (size_t i = 0; i < snapshot->keys.size(); i++) {
+                uint32_t hits = snapshot->hits[i].exchange(0);
+                if (hits > 0) {
+                    apply(snapshot->keys[i], hits);
+                }
+            }
+        }
+    }
+
+    // Whether an operation may leave `level` at `size` keys against its
+    // capacity `limit` because the compactor will restore it; if so, marks
+    // the level for the compactor. Past the slack, the operation moves just
+    // enough keys to return within it and leaves the rest marked. The
+    // compactor itself never defers, but marks levels its cascades may
+    // leave unbalanced once out of moves, as do operations with a move
+    // budget.
+    bool defer_compaction(size_type level, size_type size, size_type limit, level_guard& guard) {
+        if constexpr (concurrent) {
+            if (compactor_ == nullptr) {
+                return false;
+            }
+
+            uint64_t bit = uint64_t(1) << level;
+            bool marked = compactor_->unbalanced.fetch_or(bit) & bit;
+            if (compactor::active()) {
+                return false;
+            }
+
+            if (!marked) {
+                std::lock_guard<std::mutex> lock(compactor_->mutex);
+                compactor_->wake.notify_one();
+            }
+
+            size_type drift = compactor_->slack * limit;
+            if (size > limit + drift) {
+                guard.restrict(size - limit - drift);
+                return false;
+            } else if (size + drift < limit) {
+                guard.restrict(limit - drift - size);
+                return false;
+            }
+            return true;
+        } else {
+            if (move_budget_ != std::numeric_limits<size_type>::max() && level < 64) {
+                pending_ |= uint64_t(1) << level;
+            }
+            return false;
+        }
+    }
+
+    // Continues any reshape in progress, then the compactions that earlier
+    // operations ran out of moves for, and returns the moves left for the
+    // calling operation, which must not hold iterators yet.
+    size_type resume_compaction() {
+        if constexpr (!concurrent) {
+            if (pending_ != 0 || reshaping_ < levels()) {
+                level_guard guard(*this, move_budget_);
+                while (reshaping_ < levels() && !guard.exhausted()) {
+                    static_cast<Derived&>(*this).reshape_level(reshaping_, guard);
+                    trim();
+                    if (!guard.exhausted()) {
+                        reshaping_++;
+                    }
+                }
+                if (reshaping_ >= levels()) {
+                    reshaping_ = std::numeric_limits<size_type>::max();
+                }
+
+                // Levels marked again, e.g. one that cannot be filled yet,
+                // wait for the next operation.
+                uint64_t marked = std::exchange(pending_, 0);
+                while (marked != 0 && !guard.exhausted()) {
+                    size_type level = 63 - __builtin_clzll(marked);
+                    marked &= ~(uint64_t(1) << level);
+                    if (level < levels()) {
+                        static_cast<Derived&>(*this).rebalance(level, guard);
+                    }
+                }
+                pending_ |= marked;
+                return guard.moves();
+            }
+        }
+        return move_budget_;
+    }
+
+    // Bounds the total weight of the keys, turning the forest into a cache;
+    // published by forests that evict. Each key weighs weigh(it), 1 by 
+    // default (e.g. its size in bytes for a memory budget), and must keep its
+    // weight while stored. Inserts beyond the budget evict keys from the 
+    // bottom level in the forest's replacement order, passing each to 
+    // on_evict first. Not safe to call concurrently.
+    void set_budget(size_type budget, std::function<size_type(iterator)> weigh = {}, 
+            std::function<void(iterator)> on_evict = {}) {
+        budget_ = budget;
+        weigh_ = std::move(weigh);
+        on_evict_ = std::move(on_evict);
+        reweigh();
+    }
+
+    size_type weight() const {
+        return weight_;
+    }
+
+    // Snapshots start with a magic number, the forest's kind (and whether it
+    // is mapped) and its number of levels; forests then write every level.
+    static constexpr uint32_t snapshot_magic = 0x31465348;
+
+    void write_header(std::ostream& out, uint32_t kind) const {
+        serializer<uint32_t>::write(out, snapshot_magic);
+        serializer<uint32_t>::write(out, kind | (is_map ? 0x100 : 0));
+        serializer<uint64_t>::write(out, levels());
+    }
+
+    size_type read_header(std::istream& in, uint32_t kind) const {
+        if (read_checked<uint32_t>(in) != snapshot_magic || read_checked<uint32_t>(in) != (kind | (is_map ? 0x100 : 0))) {
+            throw std::runtime_error("search_forest: not a snapshot of this forest type");
+        }
+        return read_checked<uint64_t>(in);
+    }
+
+    template <typename Value>
+    static void write_payload(std::ostream& out, const Value& value) {
+        if constexpr (is_map) {
+            serializer<mapped_type>::write(out, value.second.value());
+        }
+    }
+
+    // The level entry for `metadata` with the payload that follows in `in`.
+    static auto read_entry(std::istream& in, metadata_type metadata) {
+        if constexpr (is_map) {
+            return make_entry(std::move(metadata), read_checked<mapped_type>(in));
+        } else {
+            return make_entry(std::move(metadata));
+        }
+    }
+
+    size_type weigh(iterator it) const {
+        return weigh_ ? weigh_(it) : 1;
+    }
+
+    void charge(iterator it) {
+        weight_ += weigh(it);
+    }
+
+    bool over_budget() const {
+        return weight_ > budget_;
+    }
+
+    // Records how far a learned forest's predicted level was from a hit.
+    void record_prediction(size_type predicted, iterator it) const {
+        if (it != end()) {
+            stats_.prediction(predicted, it.level());
+        }
+    }
+
+    // Erases a key on request, refunding its weight; the caller removes its
+    // metadata.
+    void discard(iterator it) {
+        weight_ -= weigh(it);
+        erase(it);
+    }
+
+    // Erases a key chosen for eviction; the caller removes its metadata.
+    void evict(iterator it) {
+        weight_ -= weigh(it);
+        if (on_evict_) {
+            on_evict_(it);
+        }
+        erase(it);
+    }
+
+    void reweigh() {
+        size_type weight = 0;
+        for (size_type i = 0; i < levels(); i++) {
+            for (auto it = levels_[i].begin(); it != levels_[i].end(); ++it) {
+                weight += weigh(iterator(it, i));
+            }
+        }
+        weight_ = weight;
+    }
+
+    // Moves a key to another level with new metadata, along with its payload.
+    iterator relocate(iterator from_it, metadata_type metadata, size_type to_level) {
+        if (to_level < from_it.level_) {
+            upward_moves_++;
+        }
+        stats_.move(from_it.level_, to_level);
+
+        if constexpr (has_node_handles<level_type>::value) {
+            size_type from_level = from_it.level_;
+            filters_[from_level].erase(filter_type::hash(from_it->first));
+            auto node = levels_[from_level].extract(from_it.iter_);
+            mark_dirty(from_level);
+            if constexpr (is_map) {
+                node.mapped().metadata = std::move(metadata);
+            } else {
+                node.mapped() = std::move(metadata);
+            }
+
+            grow(to_level);
+            auto it = levels_[to_level].insert(std::move(node)).position;
+            filter_insert(to_level, it->first);
+            mark_dirty(to_level);
+#ifdef HSF_DEBUG
+            if (levels_[from_level].size() < min_capacity_(from_level)) {
+                promotions_++;
+            }
+            if (levels_[to_level].size() > max_capacity_(to_level)) {
+                compactions_++;
+            }
+#endif
+            return iterator(it, to_level);
+        } else {
+            value_type value(from_it->first, move_entry(std::move(metadata), from_it));
+            erase(from_it);
+            return insert(std::move(value), to_level);
+        }
+    }
+
+    // Moves keys of `from_level` to `to_level` with new metadata, as relocate
+    // would one at a time. Ordered levels are swept once in key order when
+    // that is cheaper than searching for every key, and containers without
+    // node handles are then rebuilt by merging rather than shifted per key.
+    void relocate_batch(size_type from_level, std::vector<std::pair<key_type, metadata_type>>& entries, size_type to_level) {
+        if (entries.empty()) {
+            return;
+        }
+
+        grow(to_level);
+        auto& from = levels_[from_level];
+        auto& to = levels_[to_level];
+        if (to_level < from_level) {
+            upward_moves_ += entries.size();
+        }
+        for (size_type i = 0; i < entries.size(); i++) {
+            stats_.move(from_level, to_level);
+        }
+
+        bool sweep_from = false;
+        bool sweep_to = false;
+        if constexpr (ordered_levels) {
+            typename level_type::key_compare compare;
+            std::sort(entries.begin(), entries.end(), [&](const auto& a, const auto& b) {
+                return compare(a.first, b.first);
+            });
+            sweep_from = from.size() <= entries.size() * std::log2(from.size() + 1);
+            sweep_to = to.size() <= entries.size() * std::log2(to.size() + 1);
+        }
+
+        if constexpr (has_node_handles<level_type>::value) {
+            auto from_it = from.begin();
+            auto to_it = to.begin();
+            for (auto& [key, metadata] : entries) {
+                if constexpr (ordered_levels) {
+                    typename level_type::key_compare compare;
+                    if (sweep_from) {
+                        while (compare(from_it->first, key)) {
+                            ++from_it;
+                        }
+                    } else {
+                        from_it = from.find(key);
+                    }
+                } else {
+                    from_it = from.find(key);
+                }
+                assert(from_it != from.end());
+
+                filters_[from_level].erase(filter_type::hash(key));
+                auto node = from.extract(from_it++);
+                if constexpr (is_map) {
+                    node.mapped().metadata = std::move(metadata);
+                } else {
+                    node.mapped() = std::move(metadata);
+                }
+
+                if constexpr (ordered_levels) {
+                    typename level_type::key_compare compare;
+                    if (sweep_to) {
+                        while (to_it != to.end() && compare(to_it->first, key)) {
+                            ++to_it;
+                        }
+                        to.insert(to_it, std::move(node));
+                    } else {
+                        to.insert(std::move(node));
+                    }
+                } else {
+                    to.insert(std::move(node));
+                }
+                filter_insert(to_level, key);
+            }
+        } else {
+            std::vector<value_type> moved;
+            moved.reserve(entries.size());
+            if (sweep_from) {
+                typename level_type::key_compare compare;
+                level_type kept;
+                auto entry = entries.begin();
+                for (auto it = from.begin(); it != from.end(); ++it) {
+                    if (entry != entries.end() && !compare(it->first, entry->first)) {
+                        moved.emplace_back(entry->first, move_entry(std::move(entry->second), iterator(it, from_level)));
+                        ++entry;
+                    } else {
+                        kept.emplace_hint(kept.end(), it->first, std::move(it->second));
+                    }
+                }
+                assert(entry == entries.end());
+                from = std::move(kept);
+            } else {
+                for (auto& [key, metadata] : entries) {
+                    auto from_it = find_in_level(key, from_level);
+                    assert(from_it != end());
+                    moved.emplace_back(key, move_entry(std::move(metadata), from_it));
+                    from.erase(from_it.iter_);
+                }
+            }
+
+            if (sweep_to) {
+                typename level_type::key_compare compare;
+                level_type merged;
+                auto next = moved.begin();
+                for (auto it = to.begin(); it != to.end(); ++it) {
+                    for (; next != moved.end() && compare(next->first, it->first); ++next) {
+                        merged.emplace_hint(merged.end(), std::move(*next));
+                    }
+                    merged.emplace_hint(merged.end(), it->first, std::move(it->second));
+                }
+                for (; next != moved.end(); ++next) {
+                    merged.emplace_hint(merged.end(), std::move(*next));
+                }
+                to = std::move(merged);
+            } else {
+                for (auto& value : moved) {
+                    to.insert(std::move(value));
+                }
+            }
+
+            for (const auto& [key, metadata] : entries) {
+                filters_[from_level].erase(filter_type::hash(key));
+                filter_insert(to_level, key);
+            }
+        }
+
+        mark_dirty(from_level);
+        mark_dirty(to_level);
+#ifdef HSF_DEBUG
+        if (from.size() < min_capacity_(from_level)) {
+            promotions_++;
+        }
+        if (to.size() > max_capacity_(to_level)) {
+            compactions_++;
+        }
+#endif
+    }
+
+    // The level entry for a new key; in a mapped forest its payload is 
+    // constructed from `params`.
+    template <typename... Params>
+    static auto make_entry(metadata_type metadata, Params&&... params) {
+        if constexpr (is_map) {
+            using entry_type = typename level_type::mapped_type;
+            return entry_type{std::move(metadata), std::make_unique<mapped_type>(std::forward<Params>(params)...)};
+        } else {
+            static_assert(sizeof...(Params) == 0, "search_forest: payload given to a set");
+            return metadata;
+        }
+    }
+
+    // The level entry for a key moving out of `from_it`, taking its payload.
+    static auto move_entry(metadata_type metadata, iterator from_it) {
+        if constexpr (is_map) {
+            using entry_type = typename level_type::mapped_type;
+            return entry_type{std::move(metadata), std::move(from_it->second.payload)};
+        } else {
+            return metadata;
+        }
+    }
+
+    // The metadata of an entry, given by reference or as a container proxy.
+    template <typename Value>
+    static decltype(auto) metadata(Value&& value) {
+        if constexpr (is_map) {
+            return (value.second.metadata);
+        } else {
+            return (value.second);
+        }
+    }
+
+    static void record_hit(std::atomic<uint32_t>& hits) {
+        thread_local uint32_t skipped = 0;
+        if (++skipped == policy_type::hit_sampling) {
+            skipped = 0;
+            hits.store(hits.load(std::memory_order_relaxed) + policy_type::hit_sampling, std::memory_order_relaxed);
+        }
+    }
+
+    void filter_insert(size_type level, const key_type& key) {
+        auto& filter = filters_[level];
+        if (filter.size() < filter.capacity()) {
+            filter.insert(filter_type::hash(key));
+        } else {
+            rebuild_filter(level);
+        }
+    }
+
+    // Sizes the filter by the level's contents rather than its capacity,
+    // which for deep levels far exceeds any realistic key count; inserts
+    // rebuild it again once it fills.
+    void rebuild_filter(size_type level) {
+        if constexpr (!std::is_same_v<filter_type, null_filter<key_type>>) {
+            auto& filter = filters_[level];
+            filter.reset(std::max<size_type>(1, 2 * levels_[level].size()));
+            for (const auto& value : levels_[level]) {
+                filter.insert(filter_type::hash(value.first));
+            }
+        }
+    }
+
+    void mark_dirty(size_type level) {
+        if constexpr (hot_levels > 0) {
+            if (level < hot_levels) {
+                dirty_[level] = true;
+            }
+        }
+    }
+
+    // Replaces the snapshot of a modified hot level, carrying over hits that
+    // have not been drained yet. Requires the level to be locked exclusively.
+    void publish(size_type level) {
+        if constexpr (hot_levels > 0) {
+            if (level >= hot_levels || !dirty_[level]) {
+                return;
+            }
+
+            auto snapshot = new level_snapshot();
+            snapshot->keys.reserve(levels_[level].size());
+            for (const auto& value : levels_[level]) {
+                snapshot->keys.push_back(value.first);
+            }
+            snapshot->hits.reset(new std::atomic<uint32_t>[snapshot->keys.size()]());
+
+            level_snapshot* old_snapshot = snapshots_[level].load();
+            bool has_hits = false;
+            for (size_t i = 0; old_snapshot != nullptr && i < old_snapshot->keys.size() && !has_hits; i++) {
+                has_hits = old_snapshot->hits[i].load() > 0;
+            }
+
+            if (has_hits) {
+                typename level_type::key_compare compare;
+                size_t j = 0;
+                for (size_t i = 0; i < old_snapshot->keys.size(); i++) {
+                    while (j < snapshot->keys.size() && compare(snapshot->keys[j], old_snapshot->keys[i])) {
+                        j++;
+                    }
+                    if (j < snapshot->keys.size() && !compare(old_snapshot->keys[i], snapshot->keys[j])) {
+                        snapshot->hits[j].store(old_snapshot->hits[i].load());
+                    }
+                }
+            }
+
+            snapshots_[level].store(snapshot, std::memory_order_release);
+            epochs_.retire(old_snapshot);
+            dirty_[level] = false;
+        }
+    }
+
+    // A background compaction thread and the levels marked for it.
+    struct compactor {
+        std::thread thread;
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::atomic<uint64_t> unbalanced{0};
+        bool stopping = false;
+        double slack = 0;
+        size_type chunk = 0;
+
+        // Whether the calling thread is a compactor, which never defers.
+        static bool& active() {
+            thread_local bool value = false;
+            return value;
+        }
+    };
+
+    // Rebalances the deepest marked level first, one chunk at a time, so a
+    // cascade drains each level before the level above pushes more keys
+    // into it.
+    void run_compactor() {
+        compactor::active() = true;
+        std::unique_lock<std::mutex> lock(compactor_->mutex);
+        while (true) {
+            compactor_->wake.wait(lock, [&] {
+                return compactor_->stopping || compactor_->unbalanced.load() != 0;
+            });
+            if (compactor_->unbalanced.load() == 0) {
+                return;
+            }
+
+            lock.unlock();
+            while (uint64_t unbalanced = compactor_->unbalanced.load()) {
+                size_type level = 63 - __builtin_clzll(unbalanced);
+                compactor_->unbalanced.fetch_and(~(uint64_t(1) << level));
+                if (level >= levels()) {
+                    continue;
+                }
+
+                level_guard guard(*this, compactor_->chunk);
+                if (level > 0) {
+                    guard.acquire(level - 1);
+                }
+                guard.acquire(level);
+                static_cast<Derived&>(*this).rebalance(level, guard);
+                if (guard.exhausted()) {
+                    compactor_->unbalanced.fetch_or(uint64_t(1) << level);
+                }
+            }
+            lock.lock();
+        }
+    }
+
+    void grow(size_type level) {
+        if constexpr (fixed_levels > 0) {
+            if (level >= fixed_levels) {
+                throw std::length_error("search_forest: too many levels");
+            }
+        } else if constexpr (concurrent) {
+            if (level >= levels_.size()) {
+                throw std::length_error("search_forest: too many levels");
+            }
+            
+            size_type count = level_count_.load();
+            while (count <= level && !level_count_.compare_exchange_weak(count, level + 1)) {}
+        } else {
+            while (level >= levels_.size()) {
+                levels_.emplace_back();
+                filters_.emplace_back();
+            }
+            level_count_ = levels_.size();
+        }
+    }
+
+    // Drops empty levels from the bottom of a forest that is not of fixed
+    // depth, e.g. once a reshape lifted their keys, so that the lowest level
+    // holding keys is the bottom again.
+    void trim() {
+        if constexpr (fixed_levels == 0) {
+            while (levels() > 1 && levels_[levels() - 1].empty()) {
+                if constexpr (concurrent) {
+                    level_count_--;
+                } else {
+                    levels_.pop_back();
+                    filters_.pop_back();
+                    level_count_ = levels_.size();
+                }
+            }
+        }
+    }
+
+    template <typename T>
+    using level_array = std::conditional_t<(fixed_levels > 0), std::array<T, fixed_levels>, std::vector<T>>;
+
+    capacity_schedule<capacity_type, fixed_levels> min_capacity_;
+    capacity_schedule<capacity_type, fixed_levels> max_capacity_;
+    level_array<level_type> levels_;
+    level_array<filter_type> filters_;
+    mutable std::vector<mutex_type> locks_;
+    counter_type<size_type> total_size_;
+    counter_type<size_type> level_count_;
+    counter_type<size_type> upward_moves_ = 0;
+    counter_type<size_type> weight_ = 0;
+    size_type budget_ = std::numeric_limits<size_type>::max();
+    std::function<size_type(iterator)> weigh_;
+    std::function<void(iterator)> on_evict_;
+    std::array<std::atomic<level_snapshot*>, hot_levels> snapshots_{};
+    std::array<bool, hot_levels> dirty_{};
+    std::conditional_t<(hot_levels > 0), epoch_domain, null_epoch_domain> epochs_;
+    stats_type stats_;
+    std::unique_ptr<compactor> compactor_;
+    size_type move_budget_ = std::numeric_limits<size_type>::max();
+    uint64_t pending_ = 0;
+    size_type reshaping_ = std::numeric_limits<size_type>::max();
 };
 
 struct capacity {
@@ -149,7 +1832,8 @@ struct capacity {
         : base(base), scale(top_size * fill_factor / base) {}
 
     constexpr size_t operator()(size_t level) const {
-        return std::pow(base, std::pow(base, level)) * scale;
+        double value = std::pow(base, std::pow(base, level)) * scale;
+        return value < std::numeric_limits<size_t>::max() ? size_t(value) : std::numeric_limits<size_t>::max();
     }
 };
 
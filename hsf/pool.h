@@ -0,0 +1,198 @@
+#ifndef HSF_POOL_H
+#define HSF_POOL_H
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace hsf {
+
+// Free lists of fixed-size blocks carved from 64KB arenas. Each thread
+// allocates from and frees to its own list without synchronization; a
+// thread's list is handed to a shared list when it exits, and threads that
+// run out take the shared list before carving a new arena. Arenas are kept
+// for reuse and never returned to the system.
+template <size_t Size, size_t Align>
+class node_pool {
+public:
+    static void* allocate() {
+        if (exited()) {
+            return allocate_shared();
+        }
+
+        auto& local = local_list();
+        if (local.head == nullptr) {
+            refill(local);
+        }
+
+        block* result = local.head;
+        local.head = result->next;
+        return result;
+    }
+
+    static void deallocate(void* pointer) {
+        block* freed = static_cast<block*>(pointer);
+        if (exited()) {
+            auto& shared = shared_pool();
+            std::lock_guard<std::mutex> lock(shared.mutex);
+            push(shared.head, shared.tail, freed);
+            return;
+        }
+
+        auto& local = local_list();
+        push(local.head, local.tail, freed);
+    }
+
+private:
+    union block {
+        block* next;
+        alignas(Align) unsigned char bytes[Size];
+    };
+
+    static constexpr size_t arena_bytes = size_t(1) << 16;
+    static constexpr size_t arena_blocks = std::max<size_t>(1, arena_bytes / sizeof(block));
+
+    // Lists keep their tail, so a whole list is handed over in constant time.
+    struct shared_list {
+        std::mutex mutex;
+        block* head = nullptr;
+        block* tail = nullptr;
+        std::vector<block*> arenas;
+    };
+
+    struct thread_list {
+        block* head = nullptr;
+        block* tail = nullptr;
+
+        ~thread_list() {
+            exited() = true;
+            if (head == nullptr) {
+                return;
+            }
+
+            auto& shared = shared_pool();
+            std::lock_guard<std::mutex> lock(shared.mutex);
+            tail->next = shared.head;
+            if (shared.head == nullptr) {
+                shared.tail = tail;
+            }
+            shared.head = head;
+        }
+    };
+
+    static void push(block*& head, block*& tail, block* freed) {
+        freed->next = head;
+        if (head == nullptr) {
+            tail = freed;
+        }
+        head = freed;
+    }
+
+    // Never destroyed, so containers destroyed during exit can still free.
+    static shared_list& shared_pool() {
+        static shared_list* shared = new shared_list();
+        return *shared;
+    }
+
+    static thread_list& local_list() {
+        thread_local thread_list local;
+        return local;
+    }
+
+    // Whether this thread's list has been destroyed, e.g. while containers
+    // with static storage are destroyed at exit, after which the thread
+    // allocates from and frees to the shared list.
+    static bool& exited() {
+        thread_local bool value = false;
+        return value;
+    }
+
+    static void* allocate_shared() {
+        auto& shared = shared_pool();
+        std::lock_guard<std::mutex> lock(shared.mutex);
+        if (shared.head == nullptr) {
+            carve(shared.head, shared.tail, shared);
+        }
+
+        block* result = shared.head;
+        shared.head = result->next;
+        return result;
+    }
+
+    static void refill(thread_list& local) {
+        auto& shared = shared_pool();
+        std::lock_guard<std::mutex> lock(shared.mutex);
+        if (shared.head != nullptr) {
+            local.head = std::exchange(shared.head, nullptr);
+            local.tail = std::exchange(shared.tail, nullptr);
+            return;
+        }
+        carve(local.head, local.tail, shared);
+    }
+
+    // Makes a new arena the list's blocks; the shared list's mutex is held.
+    static void carve(block*& head, block*& tail, shared_list& shared) {
+        block* arena = new block[arena_blocks];
+        shared.arenas.push_back(arena);
+        for (size_t i = 0; i + 1 < arena_blocks; i++) {
+            arena[i].next = &arena[i + 1];
+        }
+        arena[arena_blocks - 1].next = nullptr;
+        head = arena;
+        tail = &arena[arena_blocks - 1];
+    }
+};
+
+// Stateless allocator serving single objects (i.e. container nodes) from a
+// node_pool shared by all allocators of the same node size.
+template <typename T>
+class pool_allocator {
+public:
+    using value_type = T;
+    using is_always_equal = std::true_type;
+
+    pool_allocator() = default;
+
+    template <typename U>
+    pool_allocator(const pool_allocator<U>&) {}
+
+    T* allocate(size_t n) {
+        if (n == 1) {
+            return static_cast<T*>(node_pool<sizeof(T), alignof(T)>::allocate());
+        }
+        return std::allocator<T>().allocate(n);
+    }
+
+    void deallocate(T* pointer, size_t n) {
+        if (n == 1) {
+            node_pool<sizeof(T), alignof(T)>::deallocate(pointer);
+        } else {
+            std::allocator<T>().deallocate(pointer, n);
+        }
+    }
+
+    template <typename U>
+    bool operator==(const pool_allocator<U>&) const {
+        return true;
+    }
+
+    template <typename U>
+    bool operator!=(const pool_allocator<U>&) const {
+        return false;
+    }
+};
+
+// std::map with pooled nodes, for use as a forest's level container.
+template <typename Key, typename T, typename Compare = std::less<Key>>
+using pooled_map = std::map<Key, T, Compare, pool_allocator<std::pair<const Key, T>>>;
+
+}
+
+#endif
@@ -3,65 +3,286 @@
 
 #include <algorithm>
 #include <cassert>
+#include <istream>
 #include <list>
+#include <ostream>
 #include <queue>
+#include <stdexcept>
 #include <vector>
 
 #include "hsf.h"
+#include "pool.h"
 #include "prediction.h"
 
 namespace hsf {
 
 template <
+    typename Policy,
     typename Capacity,
     template <typename, typename, typename...> class Container,
     typename Key,
     typename... Args
 >
-class recency_forest : public search_forest<recency_forest<Capacity, Container, Key, Args...>> {
+class basic_recency_forest : public search_forest<basic_recency_forest<Policy, Capacity, Container, Key, Args...>> {
 public:
-    using parent_type = search_forest<recency_forest<Capacity, Container, Key, Args...>>; 
+    using parent_type = search_forest<basic_recency_forest<Policy, Capacity, Container, Key, Args...>>; 
     using key_type = typename parent_type::key_type;
     using value_type = typename parent_type::value_type;
     using size_type = typename parent_type::size_type;
     using iterator = typename parent_type::iterator;
+    using parent_type::set_budget;
+    using parent_type::weight;
+    using recency_list = typename forest_traits<basic_recency_forest>::recency_list;
 
     template <typename... Params>
-    explicit recency_forest(Params&&... params) 
+    explicit basic_recency_forest(Params&&... params) 
         : parent_type(std::forward<Params>(params)...) {
-        recencies_.emplace_back();
+        recencies_.resize(parent_type::levels_.size());
     }
 
-    iterator find(const key_type& key, size_type hint = 0) {
-        auto it = parent_type::find(key, hint);
-        if (it == parent_type::end()) {
-            return it;
+    ~basic_recency_forest() {
+        parent_type::stop_compaction();
+    }
+
+    template <typename K>
+    iterator find(const K& key, size_type hint = 0) {
+        if constexpr (parent_type::hot_levels > 0) {
+            auto it = parent_type::find_hot(key, hint, 1, false);
+            if (it != parent_type::end()) {
+                return it;
+            }
         }
 
-        size_type level = it.level();
-        if (level > 0) {
+        size_type moves = parent_type::resume_compaction();
+        while (true) {
+            auto it = parent_type::locate(key, hint);
+            if (it == parent_type::end() || it.level() == 0) {
+                parent_type::record_lookup(it);
+                return it;
+            }
+
+            size_type level = it.level();
+
+            level_guard guard(*this, moves);
+            for (size_type i = 0; i <= level; i++) {
+                guard.acquire(i);
+            }
+
+            if constexpr (parent_type::concurrent) {
+                it = parent_type::find_in_level(key, level);
+                if (it == parent_type::end()) {
+                    continue;
+                }
+            }
+            parent_type::record_lookup(it);
+
             it = move_iterator(it, 0);
-            compact_level(0);
-            fill_level(level);
+            compact_level(0, guard);
+            fill_level(level, guard);
+            return parent_type::refresh(it, key);
         }
+    }
 
-        return it;
+    // Looks up a batch of keys with one sweep per level, then promotes them
+    // in order of their last access and compacts once for the whole batch.
+    std::vector<iterator> find_batch(const std::vector<key_type>& keys, size_type hint = 0) {
+        level_guard guard(*this, parent_type::resume_compaction());
+        for (size_type i = 0; i < parent_type::levels(); i++) {
+            guard.acquire(i);
+        }
+
+        auto batch = parent_type::make_batch(keys, std::vector<size_type>(keys.size(), hint));
+        auto found = parent_type::locate_batch(batch.keys, batch.hints, false);
+        parent_type::record_lookups(batch, found);
+
+        std::vector<size_type> order;
+        std::vector<bool> seen(found.size(), false);
+        for (size_type i = keys.size(); i-- > 0;) {
+            size_type k = batch.positions[i];
+            if (!seen[k]) {
+                seen[k] = true;
+                order.push_back(k);
+            }
+        }
+
+        std::vector<size_type> from_levels;
+        for (auto k = order.rbegin(); k != order.rend(); k++) {
+            auto& it = found[*k];
+            if (it != parent_type::end() && it.level() > 0) {
+                from_levels.push_back(it.level());
+                it = move_iterator(parent_type::refresh(it, batch.keys[*k]), 0);
+            }
+        }
+
+        if (!from_levels.empty()) {
+            compact_level(0, guard);
+
+            std::sort(from_levels.rbegin(), from_levels.rend());
+            from_levels.erase(std::unique(from_levels.begin(), from_levels.end()), from_levels.end());
+            for (size_type level : from_levels) {
+                fill_level(level, guard);
+            }
+
+            for (size_type k = 0; k < found.size(); k++) {
+                batch.hints[k] = found[k].level();
+            }
+            found = parent_type::locate_batch(batch.keys, batch.hints, false);
+        }
+
+        return parent_type::scatter(batch, found);
     }
 
     iterator insert(const key_type& key) {
-        size_type level = parent_type::levels() - 1;
-        recencies_[level].push_front(key);
-        auto rec_it = recencies_[level].begin();
-        auto it = parent_type::insert({key, rec_it}, level);
-        compact_level(level);
-        return it;
+        return emplace(key);
+    }
+
+    // Inserts a new key; in a mapped forest its payload is constructed in
+    // place from `params`. Returns end() if a budget evicts the key at once.
+    template <typename... Params>
+    iterator emplace(const key_type& key, Params&&... params) {
+        level_guard guard(*this, parent_type::resume_compaction());
+        return emplace_locked(key, guard, std::forward<Params>(params)...);
+    }
+
+    // Inserts a key unless present, in which case it is not accessed. Every
+    // level is held from the lookup to the insert, so concurrent calls never
+    // both insert the key.
+    template <typename... Params>
+    std::pair<iterator, bool> try_emplace(const key_type& key, Params&&... params) {
+        level_guard guard(*this, parent_type::resume_compaction());
+        parent_type::acquire_all(guard);
+        auto it = parent_type::find_from(key, 0);
+        if (it != parent_type::end()) {
+            return {it, false};
+        }
+        return {emplace_locked(key, guard, std::forward<Params>(params)...), true};
+    }
+
+    // Erases a key and its recency, then refills its level from the levels
+    // above. Returns the number of keys erased.
+    template <typename K>
+    size_type erase(const K& key) {
+        while (true) {
+            auto it = parent_type::locate(key, 0);
+            if (it == parent_type::end()) {
+                return 0;
+            }
+
+            if constexpr (!parent_type::concurrent) {
+                erase(it);
+                return 1;
+            } else {
+                size_type level = it.level();
+                level_guard guard(*this);
+                for (size_type i = 0; i <= level; i++) {
+                    guard.acquire(i);
+                }
+
+                it = parent_type::find_in_level(key, level);
+                if (it == parent_type::end()) {
+                    continue;
+                }
+                erase_entry(it);
+                fill_level(level, guard);
+                return 1;
+            }
+        }
+    }
+
+    // Erases the key at `it`. Concurrent forests erase by key, since their
+    // iterators may be moved from under them.
+    void erase(iterator it) {
+        static_assert(!parent_type::concurrent, "recency_forest: concurrent forests erase by key");
+        size_type level = it.level();
+        erase_entry(it);
+        level_guard guard(*this, parent_type::resume_compaction());
+        fill_level(level, guard);
+    }
+
+    // Writes every level's keys from most to least recent, with their
+    // payloads. Holds all levels while writing.
+    void save(std::ostream& out) {
+        level_guard guard(*this);
+        for (size_type level = 0; level < parent_type::levels(); level++) {
+            guard.acquire(level);
+        }
+
+        parent_type::write_header(out, snapshot_kind);
+        for (size_type level = 0; level < parent_type::levels(); level++) {
+            serializer<uint64_t>::write(out, recencies_[level].size());
+            for (const auto& key : recencies_[level]) {
+                serializer<key_type>::write(out, key);
+                if constexpr (parent_type::is_map) {
+                    parent_type::write_payload(out, *parent_type::find_in_level(key, level));
+                }
+            }
+        }
+
+        if (!out) {
+            throw std::runtime_error("recency_forest: snapshot write failed");
+        }
+    }
+
+    // Restores a snapshot into an empty forest with the saved level layout,
+    // bulk building each level without compacting.
+    void load(std::istream& in, bool parallel = false) {
+        if (parent_type::size() != 0) {
+            throw std::logic_error("recency_forest: load into a non-empty forest");
+        }
+
+        size_type count = parent_type::read_header(in, snapshot_kind);
+        std::vector<recency_list> recencies(count);
+        std::vector<std::vector<value_type>> values(count);
+        for (size_type level = 0; level < count; level++) {
+            auto size = read_checked<uint64_t>(in);
+            for (uint64_t i = 0; i < size; i++) {
+                auto key = read_checked<key_type>(in);
+                recencies[level].push_back(key);
+                values[level].push_back({std::move(key), parent_type::read_entry(in, std::prev(recencies[level].end()))});
+            }
+        }
+
+        if (recencies_.size() < count) {
+            recencies_.resize(count);
+        }
+        for (size_type level = 0; level < count; level++) {
+            recencies_[level].swap(recencies[level]);
+        }
+
+        parent_type::build_levels(count, [&](size_type level) {
+            return std::move(values[level]);
+        }, parallel);
     }
 
 private:
-    std::vector<std::list<key_type>> recencies_;
+    friend parent_type;
+    using level_guard = typename parent_type::level_guard;
+    using metadata_type = typename parent_type::metadata_type;
+
+    static constexpr uint32_t snapshot_kind = 3;
+
+    std::vector<recency_list> recencies_;
+
+    // Inserts a key as the most recent of the bottom level, holding that
+    // level in `guard`.
+    template <typename... Params>
+    iterator emplace_locked(const key_type& key, level_guard& guard, Params&&... params) {
+        size_type level = parent_type::levels() - 1;
+        guard.acquire(level);
+        recencies_[level].push_front(key);
+        auto entry = parent_type::make_entry(recencies_[level].begin(), std::forward<Params>(params)...);
+        auto it = parent_type::insert({key, std::move(entry)}, level);
+        parent_type::charge(it);
+        compact_level(level, guard);
+        if (parent_type::over_budget()) {
+            evict_over_budget(guard);
+            return parent_type::find_from(key, level);
+        }
+        return parent_type::refresh(it, key);
+    }
 
     iterator move_key(const key_type& key, size_type from_level, size_type to_level) {
-        auto from_it = parent_type::find(key, from_level);
+        auto from_it = parent_type::find_in_level(key, from_level);
         if (from_it == parent_type::end()) {
             return parent_type::end();
         }
@@ -76,57 +297,135 @@ private:
 
         auto& from_list = recencies_[from_it.level()];
         auto& to_list = recencies_[to_level];
-        to_list.splice(to_list.begin(), from_list, from_it->second);
-
-        auto [key, rec_it] = *from_it;
-        parent_type::erase(from_it);
-        return parent_type::insert({key, rec_it}, to_level);
+        auto rec_it = parent_type::metadata(*from_it);
+        to_list.splice(to_list.begin(), from_list, rec_it);
+        return parent_type::relocate(from_it, rec_it, to_level);
     }
 
-    void compact_level(size_type level) {
+    void compact_level(size_type level, level_guard& guard) {
         auto [min_cap, max_cap] = parent_type::capacity(level);
         size_type level_size = parent_type::size(level);
 
-        if (level_size > max_cap) {
-            while (level_size > min_cap) {
-                assert(!recencies_[level].empty());
-                auto min_key = *recencies_[level].rbegin();
-                move_key(min_key, level, level + 1);
-                level_size--;
+        if (level_size > max_cap && !parent_type::defer_compaction(level, level_size, max_cap, guard) && guard.acquire(level + 1)) {
+            while (level + 1 >= recencies_.size()) {
+                recencies_.emplace_back();
+            }
+
+            // Splices the least recent keys ahead of the next level's in one
+            // go, then moves the keys themselves in one pass over both levels.
+            size_type count = guard.spend(level_size - min_cap);
+            assert(count <= recencies_[level].size());
+            auto first = std::prev(recencies_[level].end(), count);
+            std::vector<std::pair<key_type, metadata_type>> entries;
+            entries.reserve(count);
+            for (auto rec_it = first; rec_it != recencies_[level].end(); ++rec_it) {
+                entries.emplace_back(*rec_it, rec_it);
+            }
+            recencies_[level + 1].splice(recencies_[level + 1].begin(), recencies_[level], first, recencies_[level].end());
+            parent_type::relocate_batch(level, entries, level + 1);
+
+            // An operation out of moves may not have created the next level.
+            if (level + 1 < parent_type::levels()) {
+                compact_level(level + 1, guard);
             }
-            
-            compact_level(level + 1);
         }
 
         assert(recencies_[level].size() == parent_type::size(level));
     }
 
-    void fill_level(size_type level) {
+    // Evicts the least recently accessed keys of the lowest non-empty level
+    // until the forest is within budget.
+    void evict_over_budget(level_guard& guard) {
+        size_type level = parent_type::levels() - 1;
+        while (parent_type::over_budget() && guard.acquire(level)) {
+            if (recencies_[level].empty()) {
+                if (level == 0) {
+                    return;
+                }
+                level--;
+                continue;
+            }
+
+            parent_type::evict(parent_type::find_in_level(recencies_[level].back(), level));
+            recencies_[level].pop_back();
+        }
+    }
+
+    // Erases a key with its recency; the caller holds its level.
+    void erase_entry(iterator it) {
+        recencies_[it.level()].erase(parent_type::metadata(*it));
+        parent_type::discard(it);
+    }
+
+    void fill_level(size_type level, level_guard& guard) {
         auto [min_cap, _] = parent_type::capacity(level);
         size_type level_size = parent_type::size(level);
 
-        if (level == 0 || level == parent_type::levels() - 1 || level_size >= min_cap) {
+        if (level == 0 || level == parent_type::levels() - 1 || level_size >= min_cap
+                || parent_type::defer_compaction(level, level_size, min_cap, guard)) {
+            return;
+        }
+
+        if (!guard.acquire(level - 1)) {
             return;
         }
 
-        assert(!recencies_[level - 1].empty());
-        
-        auto min_key = *recencies_[level - 1].rbegin();
-        move_key(min_key, level - 1, level);
-        fill_level(level - 1);
+        while (level_size < min_cap && !recencies_[level - 1].empty() && guard.spend()) {
+            auto min_key = *recencies_[level - 1].rbegin();
+            move_key(min_key, level - 1, level);
+            level_size++;
+        }
+        fill_level(level - 1, guard);
+    }
+
+    // Restores a level marked for the compactor, which holds it and the
+    // level above.
+    void rebalance(size_type level, level_guard& guard) {
+        compact_level(level, guard);
+        fill_level(level, guard);
+    }
+
+    // Brings a level within new capacities: compacts it if it overflows, or
+    // splices the most recent keys of the levels below behind its own if it
+    // falls short, emptying each before the next and leaving them to be
+    // reshaped in turn.
+    void reshape_level(size_type level, level_guard& guard) {
+        compact_level(level, guard);
+
+        auto [min_cap, _] = parent_type::capacity(level);
+        for (size_type below = level + 1; below < parent_type::levels() && parent_type::size(level) < min_cap; below++) {
+            if (guard.exhausted() || !guard.acquire(below)) {
+                return;
+            }
+
+            size_type count = guard.spend(std::min<size_type>(min_cap - parent_type::size(level), recencies_[below].size()));
+            auto last = std::next(recencies_[below].begin(), count);
+            std::vector<std::pair<key_type, metadata_type>> entries;
+            entries.reserve(count);
+            for (auto rec_it = recencies_[below].begin(); rec_it != last; ++rec_it) {
+                entries.emplace_back(*rec_it, rec_it);
+            }
+            recencies_[level].splice(recencies_[level].end(), recencies_[below], recencies_[below].begin(), last);
+            parent_type::relocate_batch(below, entries, level);
+        }
     }
 };
 
 template <
+    typename Policy,
     typename Capacity,
     template <typename, typename, typename...> class Container,
     typename Key,
     typename... Args
 >
-struct forest_traits<recency_forest<Capacity, Container, Key, Args...>> {
-    using metadata_type = typename std::list<Key>::iterator;
-    using level_type = Container<Key, metadata_type, Args...>;
+struct forest_traits<basic_recency_forest<Policy, Capacity, Container, Key, Args...>> {
+    using key_type = typename key_traits<Key>::key_type;
+    using mapped_type = typename key_traits<Key>::mapped_type;
+    using recency_list = std::list<key_type, pool_allocator<key_type>>;
+    using metadata_type = typename recency_list::iterator;
+    using level_type = Container<key_type, typename key_traits<Key>::template entry_type<metadata_type>, Args...>;
     using capacity_type = Capacity;
+    using policy_type = Policy;
 };
 
 template <
@@ -135,56 +434,264 @@ template <
     typename Key,
     typename... Args
 >
-class learned_recency_forest : public search_forest<learned_recency_forest<Capacity, Container, Key, Args...>> {
+using recency_forest = basic_recency_forest<single_threaded, Capacity, Container, Key, Args...>;
+
+template <
+    typename Capacity,
+    template <typename, typename, typename...> class Container,
+    typename Key,
+    typename... Args
+>
+using concurrent_recency_forest = basic_recency_forest<level_locking, Capacity, Container, Key, Args...>;
+
+template <
+    typename Policy,
+    typename Capacity,
+    template <typename, typename, typename...> class Container,
+    typename Key,
+    typename... Args
+>
+class basic_learned_recency_forest : public search_forest<basic_learned_recency_forest<Policy, Capacity, Container, Key, Args...>> {
 public:
-    using parent_type = search_forest<learned_recency_forest<Capacity, Container, Key, Args...>>; 
+    using parent_type = search_forest<basic_learned_recency_forest<Policy, Capacity, Container, Key, Args...>>; 
     using key_type = typename parent_type::key_type;
     using value_type = typename parent_type::value_type;
     using size_type = typename parent_type::size_type;
     using iterator = typename parent_type::iterator;
     using parent_type::parent_type;
 
-    iterator find(const key_type& key, size_type prev_access, size_type next_access = -1) {
+    ~basic_learned_recency_forest() {
+        parent_type::stop_compaction();
+    }
+
+    template <typename K>
+    iterator find(const K& key, size_type prev_access, size_type next_access = -1) {
         size_type prev_level = prediction_to_level(prev_access, parent_type::min_capacity_);
-        auto it = parent_type::find(key, prev_level);
-        if (it == parent_type::end()) {
+        size_type moves = parent_type::resume_compaction();
+        while (true) {
+            auto it = parent_type::locate_around(key, prev_level);
+            if (it == parent_type::end()) {
+                parent_type::record_lookup(it);
+                return it;
+            }
+
+            size_type level = it.level();
+            size_type next_level = next_access == -1 
+                ? parent_type::levels() - 1
+                : prediction_to_level(next_access, parent_type::min_capacity_);
+
+            level_guard guard(*this, moves);
+            guard.acquire(std::min(level, next_level));
+            guard.acquire(std::max(level, next_level));
+            if constexpr (parent_type::concurrent) {
+                it = parent_type::find_in_level(key, level);
+                if (it == parent_type::end()) {
+                    continue;
+                }
+            }
+            parent_type::record_lookup(it);
+            parent_type::record_prediction(prev_level, it);
+
+            parent_type::metadata(*it) = next_access;
+            if (level != next_level) {
+                it = move_iterator(it, next_level);
+                compact_level(next_level, guard);
+                it = parent_type::refresh(it, key);
+            }
+
+            // if (next_access != -1) {
+            //     size_type next_level = prediction_to_level(next_access, parent_type::min_capacity_);
+            //     it->second = next_access;
+            //     if (level != next_level) {
+            //         it = move_iterator(it, next_level);
+            //         compact_level(next_level);
+            //     }
+            // }
+
             return it;
         }
+    }
 
-        size_type level = it.level();
-        size_type next_level = next_access == -1 
-            ? parent_type::levels() - 1
-            : prediction_to_level(next_access, parent_type::min_capacity_);
+    std::vector<iterator> find_batch(
+        const std::vector<key_type>& keys, 
+        const std::vector<size_type>& prev_accesses, 
+        const std::vector<size_type>& next_accesses
+    ) {
+        if (keys.empty()) {
+            return {};
+        }
+
+        std::vector<size_type> prev_levels(keys.size());
+        std::vector<size_type> next_levels(keys.size());
+        for (size_type i = 0; i < keys.size(); i++) {
+            prev_levels[i] = prediction_to_level(prev_accesses[i], parent_type::min_capacity_);
+            next_levels[i] = next_accesses[i] == -1 
+                ? parent_type::levels() - 1
+                : prediction_to_level(next_accesses[i], parent_type::min_capacity_);
+        }
+
+        auto batch = parent_type::make_batch(keys, prev_levels);
+        level_guard guard(*this, parent_type::resume_compaction());
+        for (size_type i = 0; i < parent_type::levels(); i++) {
+            guard.acquire(i);
+        }
+
+        auto found = parent_type::locate_batch(batch.keys, batch.hints, false);
+        parent_type::locate_above(batch, found, false);
+        parent_type::record_lookups(batch, found);
+        for (size_type i = 0; i < keys.size(); i++) {
+            parent_type::record_prediction(prev_levels[i], found[batch.positions[i]]);
+        }
 
-        it->second = next_access;
-        if (level != next_level) {
-            it = move_iterator(it, next_level);
-            compact_level(next_level);
+        std::vector<size_type> last(found.size());
+        for (size_type i = 0; i < keys.size(); i++) {
+            last[batch.positions[i]] = i;
         }
 
-        // if (next_access != -1) {
-        //     size_type next_level = prediction_to_level(next_access, parent_type::min_capacity_);
-        //     it->second = next_access;
-        //     if (level != next_level) {
-        //         it = move_iterator(it, next_level);
-        //         compact_level(next_level);
-        //     }
-        // }
+        std::vector<size_type> to_levels;
+        for (size_type k = 0; k < found.size(); k++) {
+            auto& it = found[k];
+            if (it == parent_type::end()) {
+                continue;
+            }
+
+            it = parent_type::refresh(it, batch.keys[k]);
+            size_type next_level = next_levels[last[k]];
+            parent_type::metadata(*it) = next_accesses[last[k]];
+            if (it.level() != next_level) {
+                guard.acquire(next_level);
+                it = move_iterator(it, next_level);
+                to_levels.push_back(next_level);
+            }
+        }
+
+        if (!to_levels.empty()) {
+            std::sort(to_levels.begin(), to_levels.end());
+            to_levels.erase(std::unique(to_levels.begin(), to_levels.end()), to_levels.end());
+            for (size_type level : to_levels) {
+                compact_level(level, guard);
+            }
+
+            for (size_type k = 0; k < found.size(); k++) {
+                batch.hints[k] = found[k].level();
+            }
+            found = parent_type::locate_batch(batch.keys, batch.hints, false);
+        }
 
-        return it;
+        return parent_type::scatter(batch, found);
     }
 
     iterator insert(const key_type& key, size_type next_access = -1) {
-        size_type level = next_access == -1 
-            ? parent_type::levels() - 1
-            : prediction_to_level(next_access, parent_type::min_capacity_);
+        return emplace(key, next_access);
+    }
 
-        auto it = parent_type::insert({key, next_access}, level);
-        compact_level(level);
-        return it;
+    template <typename... Params>
+    iterator emplace(const key_type& key, size_type next_access, Params&&... params) {
+        level_guard guard(*this, parent_type::resume_compaction());
+        return emplace_locked(key, next_access, guard, std::forward<Params>(params)...);
+    }
+
+    // Holds every level from the lookup to the insert, so concurrent calls
+    // never both insert the key.
+    template <typename... Params>
+    std::pair<iterator, bool> try_emplace(const key_type& key, size_type next_access, Params&&... params) {
+        level_guard guard(*this, parent_type::resume_compaction());
+        parent_type::acquire_all(guard);
+        auto it = parent_type::find_from(key, 0);
+        if (it != parent_type::end()) {
+            return {it, false};
+        }
+        return {emplace_locked(key, next_access, guard, std::forward<Params>(params)...), true};
+    }
+
+    // Erases a key. Learned levels have no minimum size, so nothing is
+    // refilled. Returns the number of keys erased.
+    template <typename K>
+    size_type erase(const K& key) {
+        while (true) {
+            auto it = parent_type::locate(key, 0);
+            if (it == parent_type::end()) {
+                return 0;
+            }
+
+            if constexpr (!parent_type::concurrent) {
+                erase(it);
+                return 1;
+            } else {
+                size_type level = it.level();
+                level_guard guard(*this);
+                guard.acquire(level);
+
+                it = parent_type::find_in_level(key, level);
+                if (it == parent_type::end()) {
+                    continue;
+                }
+                parent_type::discard(it);
+                return 1;
+            }
+        }
+    }
+
+    // Erases the key at `it`. Concurrent forests erase by key, since their
+    // iterators may be moved from under them.
+    void erase(iterator it) {
+        static_assert(!parent_type::concurrent, "learned_recency_forest: concurrent forests erase by key");
+        parent_type::discard(it);
+    }
+
+    // Writes every level's keys with their next accesses and payloads. Holds all
+    // levels while writing.
+    void save(std::ostream& out) {
+        level_guard guard(*this);
+        for (size_type level = 0; level < parent_type::levels(); level++) {
+            guard.acquire(level);
+        }
+
+        parent_type::write_header(out, snapshot_kind);
+        for (size_type level = 0; level < parent_type::levels(); level++) {
+            serializer<uint64_t>::write(out, parent_type::size(level));
+            for (const auto& value : parent_type::levels_[level]) {
+                serializer<key_type>::write(out, value.first);
+                serializer<uint32_t>::write(out, parent_type::metadata(value));
+                parent_type::write_payload(out, value);
+            }
+        }
+
+        if (!out) {
+            throw std::runtime_error("learned_recency_forest: snapshot write failed");
+        }
+    }
+
+    // Restores a snapshot into an empty forest with the saved level layout,
+    // bulk building each level without compacting.
+    void load(std::istream& in, bool parallel = false) {
+        if (parent_type::size() != 0) {
+            throw std::logic_error("learned_recency_forest: load into a non-empty forest");
+        }
+
+        size_type count = parent_type::read_header(in, snapshot_kind);
+        std::vector<std::vector<value_type>> values(count);
+        for (size_type level = 0; level < count; level++) {
+            auto size = read_checked<uint64_t>(in);
+            for (uint64_t i = 0; i < size; i++) {
+                auto key = read_checked<key_type>(in);
+                auto next_access = read_checked<uint32_t>(in);
+                values[level].push_back({std::move(key), parent_type::read_entry(in, next_access)});
+            }
+        }
+
+        parent_type::build_levels(count, [&](size_type level) {
+            return std::move(values[level]);
+        }, parallel);
     }
 
 private:
+    friend parent_type;
+    using level_guard = typename parent_type::level_guard;
+    using metadata_type = typename parent_type::metadata_type;
+
+    static constexpr uint32_t snapshot_kind = 4;
+
     struct heap_element {
         key_type key;
         uint32_t next_access;
@@ -194,19 +701,35 @@ private:
         }
     };
 
+    // Inserts a key at the level of its predicted next access, or the bottom
+    // level without one, holding that level in `guard`.
+    template <typename... Params>
+    iterator emplace_locked(const key_type& key, size_type next_access, level_guard& guard, Params&&... params) {
+        size_type level = next_access == -1 
+            ? parent_type::levels() - 1
+            : prediction_to_level(next_access, parent_type::min_capacity_);
+
+        guard.acquire(level);
+        auto entry = parent_type::make_entry(next_access, std::forward<Params>(params)...);
+        auto it = parent_type::insert({key, std::move(entry)}, level);
+        compact_level(level, guard);
+        return parent_type::refresh(it, key);
+    }
+
     iterator move_iterator(iterator from_it, size_type to_level) {
-        auto [key, next_access] = *from_it;
-        parent_type::erase(from_it);
-        return parent_type::insert({key, next_access}, to_level);
+        return parent_type::relocate(from_it, parent_type::metadata(*from_it), to_level);
     }
 
-    void compact_level(size_type level) {
+    void compact_level(size_type level, level_guard& guard) {
         auto [min_cap, max_cap] = parent_type::capacity(level);
         size_type level_size = parent_type::size(level);
 
-        if (level_size > max_cap && level == parent_type::levels() - 1) {
+        if (level_size > max_cap && level == parent_type::levels() - 1
+                && !parent_type::defer_compaction(level, level_size, max_cap, guard) && guard.acquire(level + 1)) {
             std::priority_queue<heap_element> max_accesses;
-            for (const auto& [key, next_access] : parent_type::levels_[level]) {
+            for (const auto& value : parent_type::levels_[level]) {
+                const auto& key = value.first;
+                uint32_t next_access = parent_type::metadata(value);
                 if (max_accesses.size() < level_size - min_cap) {
                     max_accesses.push({key, next_access});
                 } else if (next_access > max_accesses.top().next_access) {
@@ -215,32 +738,66 @@ private:
                 }
             }
             
-            while (!max_accesses.empty()) {
-                auto element = max_accesses.top();
+            // Keeps the latest next accesses, so a split cut short by the
+            // operation's moves still splits by next access.
+            size_type count = guard.spend(max_accesses.size());
+            while (max_accesses.size() > count) {
                 max_accesses.pop();
-
-                auto it = parent_type::find(element.key, level);
-                assert(it != parent_type::end());
-                move_iterator(it, level + 1);
             }
+            std::vector<std::pair<key_type, metadata_type>> entries;
+            entries.reserve(count);
+            for (; !max_accesses.empty(); max_accesses.pop()) {
+                entries.emplace_back(max_accesses.top().key, max_accesses.top().next_access);
+            }
+            parent_type::relocate_batch(level, entries, level + 1);
             
-            compact_level(level + 1);
+            compact_level(level + 1, guard);
         }
     }
+
+    void rebalance(size_type level, level_guard& guard) {
+        compact_level(level, guard);
+    }
+
+    // Learned levels have no minimum size, so only an overflowing bottom
+    // level is split.
+    void reshape_level(size_type level, level_guard& guard) {
+        compact_level(level, guard);
+    }
 };
 
 template <
+    typename Policy,
     typename Capacity,
     template <typename, typename, typename...> class Container,
     typename Key,
     typename... Args
 >
-struct forest_traits<learned_recency_forest<Capacity, Container, Key, Args...>> {
+struct forest_traits<basic_learned_recency_forest<Policy, Capacity, Container, Key, Args...>> {
+    using key_type = typename key_traits<Key>::key_type;
+    using mapped_type = typename key_traits<Key>::mapped_type;
     using metadata_type = uint32_t;
-    using level_type = Container<Key, metadata_type, Args...>;
+    using level_type = Container<key_type, typename key_traits<Key>::template entry_type<metadata_type>, Args...>;
     using capacity_type = Capacity;
+    using policy_type = Policy;
 };
 
+template <
+    typename Capacity,
+    template <typename, typename, typename...> class Container,
+    typename Key,
+    typename... Args
+>
+using learned_recency_forest = basic_learned_recency_forest<single_threaded, Capacity, Container, Key, Args...>;
+
+template <
+    typename Capacity,
+    template <typename, typename, typename...> class Container,
+    typename Key,
+    typename... Args
+>
+using concurrent_learned_recency_forest = basic_learned_recency_forest<level_locking, Capacity, Container, Key, Args...>;
+
 }
 
 #endif
\ No newline at end of file
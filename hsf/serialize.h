@@ -0,0 +1,66 @@
+#ifndef HSF_SERIALIZE_H
+#define HSF_SERIALIZE_H
+
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+namespace hsf {
+
+// Binary encoding of keys, metadata and payloads in forest snapshots.
+// Trivially copyable types are written as their bytes and strings (anything
+// viewable as and constructible from std::string_view) as a length and their
+// characters; specialize for other types.
+template <typename T, typename = void>
+struct serializer {
+    static_assert(std::is_trivially_copyable_v<T>, "serializer: no encoding for this type");
+
+    static void write(std::ostream& out, const T& value) {
+        out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    static T read(std::istream& in) {
+        T value{};
+        in.read(reinterpret_cast<char*>(&value), sizeof(T));
+        return value;
+    }
+};
+
+template <typename T>
+struct serializer<T, std::enable_if_t<!std::is_trivially_copyable_v<T>
+        && std::is_convertible_v<const T&, std::string_view> && std::is_constructible_v<T, std::string_view>>> {
+    static void write(std::ostream& out, const T& value) {
+        std::string_view view(value);
+        serializer<uint64_t>::write(out, view.size());
+        out.write(view.data(), view.size());
+    }
+
+    static T read(std::istream& in) {
+        auto size = serializer<uint64_t>::read(in);
+        if (!in) {
+            return T();
+        }
+
+        std::string buffer(size, '\0');
+        in.read(buffer.data(), buffer.size());
+        return T(std::string_view(buffer));
+    }
+};
+
+// Reads a value and checks that the stream still holds together.
+template <typename T>
+T read_checked(std::istream& in) {
+    T value = serializer<T>::read(in);
+    if (!in) {
+        throw std::runtime_error("search_forest: truncated snapshot");
+    }
+    return value;
+}
+
+}
+
+#endif
@@ -0,0 +1,409 @@
+#ifndef HSF_SHARDED_H
+#define HSF_SHARDED_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace hsf {
+
+// A shared-nothing front-end over `shards` independent single-threaded
+// forests of any kind, each owned by one worker thread. Keys are routed by
+// hash to their shard, and operations are queued to its worker as requests
+// on a lock-free multi-producer single-consumer queue, so no forest is ever
+// touched by two threads and callers only contend on the tail of a queue.
+// Workers drain every queued request at once before checking for more, and
+// find_batch sends each shard a single request with all of its keys, which
+// the shard's forest looks up with its own find_batch.
+//
+// Operations block until their shard has run them and return values rather
+// than iterators, which would race with the worker's later moves; execute()
+// runs any other operation on a key's shard. On Linux worker i is pinned to
+// CPU i if there are no more shards than CPUs.
+template <typename Forest, typename Hash = std::hash<typename Forest::key_type>>
+class sharded_forest {
+public:
+    using forest_type = Forest;
+    using key_type = typename Forest::key_type;
+    using size_type = typename Forest::size_type;
+
+    static_assert(!Forest::concurrent, "sharded_forest: shards are only accessed by their worker");
+
+    // Builds every shard's forest from the same parameters, e.g. its min and
+    // max capacities.
+    template <typename... Params>
+    explicit sharded_forest(size_t shards, const Params&... params) {
+        if (shards == 0) {
+            throw std::invalid_argument("sharded_forest: no shards");
+        }
+
+        shards_.reserve(shards);
+        for (size_t i = 0; i < shards; i++) {
+            shards_.push_back(std::make_unique<shard>(params...));
+        }
+        bool pin = shards <= std::thread::hardware_concurrency();
+        for (size_t i = 0; i < shards; i++) {
+            shards_[i]->worker = std::thread([this, i] { run_worker(*shards_[i]); });
+            if (pin) {
+                pin_thread(shards_[i]->worker, i);
+            }
+        }
+    }
+
+    sharded_forest(const sharded_forest&) = delete;
+    sharded_forest& operator=(const sharded_forest&) = delete;
+
+    // Waits for every queued request to run.
+    ~sharded_forest() {
+        for (auto& s : shards_) {
+            {
+                std::lock_guard<std::mutex> lock(s->mutex);
+                s->stopping = true;
+            }
+            s->wake.notify_one();
+        }
+        for (auto& s : shards_) {
+            s->worker.join();
+        }
+    }
+
+    size_t shards() const {
+        return shards_.size();
+    }
+
+    // Splits the key space by the high bits of a mixed hash, which levels
+    // hashing the same key (e.g. hash_table) do not depend on.
+    template <typename K>
+    size_t shard_of(const K& key) const {
+        uint64_t x;
+        if constexpr (std::is_invocable_v<Hash, const K&>) {
+            x = static_cast<uint64_t>(Hash{}(key));
+        } else {
+            x = static_cast<uint64_t>(Hash{}(key_type(key)));
+        }
+        x ^= x >> 33;
+        x *= 0xff51afd7ed558ccdULL;
+        x ^= x >> 33;
+        x *= 0xc4ceb9fe1a85ec53ULL;
+        x ^= x >> 33;
+        return static_cast<size_t>((static_cast<unsigned __int128>(x) * shards_.size()) >> 64);
+    }
+
+    // Runs `op(forest)` on the forest of shard `index` and returns its
+    // result, rethrowing anything it throws.
+    template <typename Op>
+    auto visit(size_t index, Op op) {
+        task<Op> t(std::move(op));
+        submit(*shards_[index], t);
+        t.wait();
+        return t.get();
+    }
+
+    // Runs `op(forest)` on the shard holding `key`.
+    template <typename K, typename Op>
+    auto execute(const K& key, Op op) {
+        return visit(shard_of(key), std::move(op));
+    }
+
+    // Whether the key is stored, passing the forest's hint or rank along.
+    template <typename K, typename... Args>
+    bool find(const K& key, Args... args) {
+        return execute(key, [&](Forest& forest) {
+            return forest.find(key, args...) != forest.end();
+        });
+    }
+
+    template <typename... Args>
+    void insert(const key_type& key, Args... args) {
+        execute(key, [&](Forest& forest) {
+            forest.insert(key, args...);
+        });
+    }
+
+    template <typename K>
+    size_type erase(const K& key) {
+        return execute(key, [&](Forest& forest) {
+            return forest.erase(key);
+        });
+    }
+
+    // Whether each key is stored, passing the forest's batch arguments
+    // along: a hint as is, and each key's rank or accesses split by shard
+    // with the keys.
+    template <typename... Args>
+    std::vector<bool> find_batch(const std::vector<key_type>& keys, const Args&... args) {
+        std::vector<std::vector<size_t>> positions(shards_.size());
+        for (size_t k = 0; k < keys.size(); k++) {
+            positions[shard_of(keys[k])].push_back(k);
+        }
+
+        std::vector<size_t> indices;
+        for (size_t i = 0; i < shards_.size(); i++) {
+            if (!positions[i].empty()) {
+                indices.push_back(i);
+            }
+        }
+
+        std::vector<bool> found(keys.size());
+        std::vector<std::vector<bool>> shard_found(shards_.size());
+        execute_each(indices, [&](size_t index) {
+            return [&, index](Forest& forest) {
+                const auto& at = positions[index];
+                auto its = forest.find_batch(gather(keys, at), gather(args, at)...);
+                shard_found[index].resize(its.size());
+                for (size_t k = 0; k < its.size(); k++) {
+                    shard_found[index][k] = its[k] != forest.end();
+                }
+            };
+        });
+        for (size_t index : indices) {
+            for (size_t k = 0; k < positions[index].size(); k++) {
+                found[positions[index][k]] = shard_found[index][k];
+            }
+        }
+        return found;
+    }
+
+    size_type size() {
+        std::vector<size_type> sizes(shards_.size());
+        execute_each(all_shards(), [&](size_t index) {
+            return [&sizes, index](Forest& forest) {
+                sizes[index] = forest.size();
+            };
+        });
+        return std::accumulate(sizes.begin(), sizes.end(), size_type(0));
+    }
+
+private:
+    // Queue node of one operation, owned by the calling thread until the
+    // worker marks it done.
+    struct request {
+        std::atomic<request*> next{nullptr};
+        void (*run)(request&, Forest&) = nullptr;
+        std::atomic<bool> done{false};
+        std::exception_ptr error;
+
+        void wait() const {
+            for (size_t spins = 0; !done.load(std::memory_order_acquire); spins++) {
+                if (spins >= 64) {
+                    std::this_thread::yield();
+                }
+            }
+        }
+    };
+
+    template <typename Op>
+    struct task : request {
+        using result_type = std::invoke_result_t<Op&, Forest&>;
+
+        explicit task(Op op) : op(std::move(op)) {
+            this->run = &task::invoke;
+        }
+
+        static void invoke(request& r, Forest& forest) {
+            auto& self = static_cast<task&>(r);
+            try {
+                if constexpr (std::is_void_v<result_type>) {
+                    self.op(forest);
+                } else {
+                    self.result.emplace(self.op(forest));
+                }
+            } catch (...) {
+                self.error = std::current_exception();
+            }
+        }
+
+        result_type get() {
+            if (this->error) {
+                std::rethrow_exception(this->error);
+            }
+            if constexpr (!std::is_void_v<result_type>) {
+                return std::move(*result);
+            }
+        }
+
+        Op op;
+        std::optional<std::conditional_t<std::is_void_v<result_type>, bool, result_type>> result;
+    };
+
+    // Vyukov's intrusive queue: producers swap themselves in as the tail with
+    // one exchange and then link the previous tail to them; the consumer
+    // follows the links from a stub node, so a request is only seen once the
+    // producer after it has linked it.
+    class request_queue {
+    public:
+        request_queue() : head_(&stub_), tail_(&stub_) {}
+
+        void push(request& r) {
+            r.next.store(nullptr, std::memory_order_relaxed);
+            request* prev = tail_.exchange(&r);
+            prev->next.store(&r, std::memory_order_release);
+        }
+
+        // The oldest request, or nullptr if there is none or its successor is
+        // still being linked. Consumer only.
+        request* pop() {
+            request* head = head_;
+            request* next = head->next.load(std::memory_order_acquire);
+            if (head == &stub_) {
+                if (next == nullptr) {
+                    return nullptr;
+                }
+                head_ = next;
+                head = next;
+                next = next->next.load(std::memory_order_acquire);
+            }
+            if (next != nullptr) {
+                head_ = next;
+                return head;
+            }
+            if (head != tail_.load(std::memory_order_acquire)) {
+                return nullptr;
+            }
+
+            push(stub_);
+            next = head->next.load(std::memory_order_acquire);
+            if (next != nullptr) {
+                head_ = next;
+                return head;
+            }
+            return nullptr;
+        }
+
+        // Whether no request has been pushed since the last one was popped.
+        // Consumer only; sequentially consistent with push's exchange.
+        bool empty() const {
+            return head_ == &stub_ && tail_.load() == &stub_;
+        }
+
+    private:
+        request stub_;
+        request* head_;
+        alignas(64) std::atomic<request*> tail_;
+    };
+
+    struct alignas(64) shard {
+        template <typename... Params>
+        explicit shard(const Params&... params) : forest(params...) {}
+
+        Forest forest;
+        request_queue queue;
+        std::thread worker;
+        std::atomic<bool> sleeping{false};
+        std::mutex mutex;
+        std::condition_variable wake;
+        bool stopping = false;
+    };
+
+    void submit(shard& s, request& r) {
+        s.queue.push(r);
+        if (s.sleeping.load()) {
+            std::lock_guard<std::mutex> lock(s.mutex);
+            s.wake.notify_one();
+        }
+    }
+
+    // Runs requests as long as any are queued, spinning briefly once the
+    // queue runs dry and then sleeping until a producer finds it asleep.
+    // Stops once asked to and every request has run.
+    void run_worker(shard& s) {
+        size_t idle = 0;
+        while (true) {
+            while (request* r = s.queue.pop()) {
+                r->run(*r, s.forest);
+                r->done.store(true, std::memory_order_release);
+                idle = 0;
+            }
+            if (!s.queue.empty() || ++idle < 1024) {
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(s.mutex);
+            s.sleeping.store(true);
+            s.wake.wait(lock, [&] {
+                return s.stopping || !s.queue.empty();
+            });
+            s.sleeping.store(false);
+            if (s.stopping && s.queue.empty()) {
+                return;
+            }
+            idle = 0;
+        }
+    }
+
+    // Runs `make_op(i)` on every shard i in `indices` at once and waits for
+    // all of them, rethrowing the first error.
+    template <typename MakeOp>
+    void execute_each(const std::vector<size_t>& indices, MakeOp make_op) {
+        using op_type = decltype(make_op(size_t(0)));
+        std::vector<std::unique_ptr<task<op_type>>> tasks;
+        tasks.reserve(indices.size());
+        for (size_t index : indices) {
+            tasks.push_back(std::make_unique<task<op_type>>(make_op(index)));
+            submit(*shards_[index], *tasks.back());
+        }
+        for (auto& t : tasks) {
+            t->wait();
+        }
+        for (auto& t : tasks) {
+            t->get();
+        }
+    }
+
+    // The elements of `values` at `positions`, or a scalar argument as is.
+    template <typename T>
+    static std::vector<T> gather(const std::vector<T>& values, const std::vector<size_t>& positions) {
+        std::vector<T> subset;
+        subset.reserve(positions.size());
+        for (size_t k : positions) {
+            subset.push_back(values[k]);
+        }
+        return subset;
+    }
+
+    template <typename T>
+    static const T& gather(const T& value, const std::vector<size_t>&) {
+        return value;
+    }
+
+    std::vector<size_t> all_shards() const {
+        std::vector<size_t> indices(shards_.size());
+        std::iota(indices.begin(), indices.end(), size_t(0));
+        return indices;
+    }
+
+    static void pin_thread(std::thread& thread, size_t cpu) {
+#ifdef __linux__
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set);
+#else
+        (void)thread;
+        (void)cpu;
+#endif
+    }
+
+    std::vector<std::unique_ptr<shard>> shards_;
+};
+
+}
+
+#endif
@@ -0,0 +1,431 @@
+#ifndef HSF_SORTED_ARRAY_H
+#define HSF_SORTED_ARRAY_H
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+namespace hsf {
+
+// Flat sorted level container with the interface of std::map. Entries live
+// in contiguous sorted chunks of at most `chunk_size` entries, indexed by a
+// flat array of each chunk's last key: the small top levels of a forest are
+// a single array that fits in L1/L2, while inserts into the large bottom
+// levels only shift one chunk. Inserts and erases invalidate iterators.
+//
+// With std::less over 32- or 64-bit signed integers, a lookup narrows the
+// range with a branchless binary search and then counts the keys below the
+// target in a final block with AVX-512/AVX2 compares (scalar otherwise).
+template <typename Key, typename T, typename Compare = std::less<Key>>
+class sorted_array {
+    struct chunk;
+
+    template <bool Const>
+    class basic_iterator;
+
+public:
+    using key_type = Key;
+    using mapped_type = T;
+    using value_type = std::pair<Key, T>;
+    using size_type = size_t;
+    using key_compare = Compare;
+    using iterator = basic_iterator<false>;
+    using const_iterator = basic_iterator<true>;
+
+    static constexpr bool stable_iterators = false;
+    static constexpr size_type chunk_size = 512;
+
+    sorted_array() : size_(0) {
+        reset_keys(lasts_);
+    }
+
+    iterator begin() {
+        return iterator(&chunks_, 0, 0);
+    }
+
+    iterator end() {
+        return iterator(&chunks_, chunks_.size(), 0);
+    }
+
+    const_iterator begin() const {
+        return const_iterator(&chunks_, 0, 0);
+    }
+
+    const_iterator end() const {
+        return const_iterator(&chunks_, chunks_.size(), 0);
+    }
+
+    size_type size() const {
+        return size_;
+    }
+
+    bool empty() const {
+        return size_ == 0;
+    }
+
+    key_compare key_comp() const {
+        return compare_;
+    }
+
+    iterator lower_bound(const key_type& key) {
+        return find_lower(key);
+    }
+
+    const_iterator lower_bound(const key_type& key) const {
+        return const_cast<sorted_array*>(this)->lower_bound(key);
+    }
+
+    iterator find(const key_type& key) {
+        return find_equal(key);
+    }
+
+    const_iterator find(const key_type& key) const {
+        return const_cast<sorted_array*>(this)->find(key);
+    }
+
+    // Lookups by any type comparable with keys, given a transparent Compare.
+    template <typename K, typename C = Compare, typename = typename C::is_transparent>
+    iterator lower_bound(const K& key) {
+        return find_lower(key);
+    }
+
+    template <typename K, typename C = Compare, typename = typename C::is_transparent>
+    iterator find(const K& key) {
+        return find_equal(key);
+    }
+
+    std::pair<iterator, bool> insert(const value_type& value) {
+        return insert_unique(value);
+    }
+
+    std::pair<iterator, bool> insert(value_type&& value) {
+        return insert_unique(std::move(value));
+    }
+
+    // Appending in key order through end() is constant time, as in std::map.
+    template <typename... Params>
+    iterator emplace_hint(const_iterator hint, Params&&... params) {
+        value_type value(std::forward<Params>(params)...);
+        auto next = iterator(&chunks_, hint.chunk_, hint.offset_);
+        bool before_next = next == end() || compare_(value.first, next->first);
+        bool after_prev = next == begin() || compare_(std::prev(next)->first, value.first);
+        if (before_next && after_prev) {
+            return insert_at(next.chunk_, next.offset_, std::move(value));
+        }
+        return insert(std::move(value)).first;
+    }
+
+    iterator erase(const_iterator it) {
+        size_type c = it.chunk_;
+        size_type offset = it.offset_;
+        auto& target = chunks_[c];
+        target.values.erase(target.values.begin() + offset);
+        if constexpr (vectorized) {
+            target.keys.erase(target.keys.begin() + offset);
+        }
+        size_--;
+
+        if (target.values.empty()) {
+            chunks_.erase(chunks_.begin() + c);
+            lasts_.erase(lasts_.begin() + c);
+            return iterator(&chunks_, c, 0);
+        }
+
+        lasts_[c] = target.values.back().first;
+        if (c + 1 < chunks_.size() && target.values.size() + chunks_[c + 1].values.size() <= chunk_size / 2) {
+            merge_next(c);
+        }
+        return normalize(c, offset);
+    }
+
+    size_type erase(const key_type& key) {
+        auto it = find(key);
+        if (it == end()) {
+            return 0;
+        }
+        erase(it);
+        return 1;
+    }
+
+    void clear() {
+        chunks_.clear();
+        reset_keys(lasts_);
+        size_ = 0;
+    }
+
+private:
+    static constexpr bool vectorized = std::is_same_v<Compare, std::less<Key>>
+        && std::is_integral_v<Key> && std::is_signed_v<Key> && (sizeof(Key) == 4 || sizeof(Key) == 8);
+
+    // Two cache lines of keys; key arrays are padded with this many maximal
+    // keys so the final block can always be loaded whole.
+    static constexpr size_type block_keys = 128 / sizeof(Key);
+
+    struct chunk {
+        std::vector<Key> keys;
+        std::vector<value_type> values;
+    };
+
+    template <bool Const>
+    class basic_iterator {
+    public:
+        using iterator_category = std::bidirectional_iterator_tag;
+        using value_type = typename sorted_array::value_type;
+        using difference_type = std::ptrdiff_t;
+        using pointer = std::conditional_t<Const, const value_type*, value_type*>;
+        using reference = std::conditional_t<Const, const value_type&, value_type&>;
+
+        basic_iterator() : chunks_(nullptr), chunk_(0), offset_(0) {}
+
+        template <bool Other, typename = std::enable_if_t<Const && !Other>>
+        basic_iterator(const basic_iterator<Other>& other)
+            : chunks_(other.chunks_), chunk_(other.chunk_), offset_(other.offset_) {}
+
+        reference operator*() const {
+            return (*chunks_)[chunk_].values[offset_];
+        }
+
+        pointer operator->() const {
+            return &**this;
+        }
+
+        basic_iterator& operator++() {
+            if (++offset_ == (*chunks_)[chunk_].values.size()) {
+                chunk_++;
+                offset_ = 0;
+            }
+            return *this;
+        }
+
+        basic_iterator operator++(int) {
+            auto it = *this;
+            ++*this;
+            return it;
+        }
+
+        basic_iterator& operator--() {
+            if (offset_ == 0) {
+                chunk_--;
+                offset_ = (*chunks_)[chunk_].values.size();
+            }
+            offset_--;
+            return *this;
+        }
+
+        basic_iterator operator--(int) {
+            auto it = *this;
+            --*this;
+            return it;
+        }
+
+        bool operator==(const basic_iterator& other) const {
+            return chunk_ == other.chunk_ && offset_ == other.offset_;
+        }
+
+        bool operator!=(const basic_iterator& other) const {
+            return !(*this == other);
+        }
+
+    private:
+        friend class sorted_array;
+        template <bool>
+        friend class basic_iterator;
+
+        using chunks_type = std::conditional_t<Const, const std::vector<chunk>, std::vector<chunk>>;
+
+        chunks_type* chunks_;
+        size_type chunk_;
+        size_type offset_;
+
+        basic_iterator(chunks_type* chunks, size_type chunk, size_type offset)
+            : chunks_(chunks), chunk_(chunk), offset_(offset) {}
+    };
+
+    std::vector<chunk> chunks_;
+    std::vector<Key> lasts_;
+    size_type size_;
+    Compare compare_;
+
+    static void reset_keys(std::vector<Key>& keys) {
+        keys.clear();
+        if constexpr (vectorized) {
+            keys.assign(block_keys, std::numeric_limits<Key>::max());
+        }
+    }
+
+    template <typename K>
+    iterator find_lower(const K& key) {
+        size_type c = search(lasts_, chunks_.size(), key);
+        if (c == chunks_.size()) {
+            return end();
+        }
+        return iterator(&chunks_, c, search(chunks_[c], key));
+    }
+
+    template <typename K>
+    iterator find_equal(const K& key) {
+        auto it = find_lower(key);
+        if (it == end() || compare_(key, it->first)) {
+            return end();
+        }
+        return it;
+    }
+
+    iterator normalize(size_type c, size_type offset) {
+        if (offset == chunks_[c].values.size()) {
+            return iterator(&chunks_, c + 1, 0);
+        }
+        return iterator(&chunks_, c, offset);
+    }
+
+    template <typename Value>
+    std::pair<iterator, bool> insert_unique(Value&& value) {
+        auto it = lower_bound(value.first);
+        if (it != end() && !compare_(value.first, it->first)) {
+            return {it, false};
+        }
+        return {insert_at(it.chunk_, it.offset_, std::forward<Value>(value)), true};
+    }
+
+    template <typename Value>
+    iterator insert_at(size_type c, size_type offset, Value&& value) {
+        if (chunks_.empty()) {
+            chunks_.emplace_back();
+            reset_keys(chunks_.back().keys);
+            lasts_.insert(lasts_.begin(), value.first);
+        }
+
+        if (c == chunks_.size()) {
+            c--;
+            offset = chunks_[c].values.size();
+        }
+
+        auto& target = chunks_[c];
+        if constexpr (vectorized) {
+            target.keys.insert(target.keys.begin() + offset, value.first);
+        }
+        target.values.insert(target.values.begin() + offset, std::forward<Value>(value));
+        lasts_[c] = target.values.back().first;
+        size_++;
+
+        if (target.values.size() > chunk_size) {
+            split(c);
+            if (offset >= chunks_[c].values.size()) {
+                offset -= chunks_[c].values.size();
+                c++;
+            }
+        }
+        return iterator(&chunks_, c, offset);
+    }
+
+    void split(size_type c) {
+        chunks_.insert(chunks_.begin() + c + 1, chunk());
+        auto& left = chunks_[c];
+        auto& right = chunks_[c + 1];
+        size_type half = left.values.size() / 2;
+
+        right.values.assign(std::make_move_iterator(left.values.begin() + half), std::make_move_iterator(left.values.end()));
+        left.values.resize(half);
+        if constexpr (vectorized) {
+            right.keys.assign(left.keys.begin() + half, left.keys.end());
+            left.keys.erase(left.keys.begin() + half, left.keys.end() - block_keys);
+        }
+
+        lasts_[c] = left.values.back().first;
+        lasts_.insert(lasts_.begin() + c + 1, right.values.back().first);
+    }
+
+    void merge_next(size_type c) {
+        auto& left = chunks_[c];
+        auto& right = chunks_[c + 1];
+        left.values.insert(left.values.end(), std::make_move_iterator(right.values.begin()), std::make_move_iterator(right.values.end()));
+        if constexpr (vectorized) {
+            left.keys.insert(left.keys.end() - block_keys, right.keys.begin(), right.keys.end() - block_keys);
+        }
+
+        lasts_[c] = left.values.back().first;
+        chunks_.erase(chunks_.begin() + c + 1);
+        lasts_.erase(lasts_.begin() + c + 1);
+    }
+
+    // Index of the first of the `length` leading entries of `keys` that is
+    // not less than `key`; `keys` is padded when vectorized.
+    template <typename K>
+    size_type search(const std::vector<Key>& keys, size_type length, const K& key) const {
+        if constexpr (vectorized) {
+            const Key* data = keys.data();
+            size_type first = 0;
+            while (length > block_keys) {
+                size_type half = length / 2;
+                first = data[first + half] < key ? first + half : first;
+                length -= half;
+            }
+            return first + count_less(data + first, key);
+        } else {
+            return std::lower_bound(keys.begin(), keys.begin() + length, key, compare_) - keys.begin();
+        }
+    }
+
+    template <typename K>
+    size_type search(const chunk& target, const K& key) const {
+        if constexpr (vectorized) {
+            return search(target.keys, target.values.size(), key);
+        } else {
+            auto it = std::lower_bound(target.values.begin(), target.values.end(), key, [&](const value_type& value, const K& key) {
+                return compare_(value.first, key);
+            });
+            return it - target.values.begin();
+        }
+    }
+
+    static size_type count_less(const Key* block, Key key) {
+        size_type count = 0;
+#if defined(__AVX512F__)
+        if constexpr (sizeof(Key) == 4) {
+            __m512i needle = _mm512_set1_epi32(key);
+            for (size_type i = 0; i < block_keys; i += 16) {
+                __m512i keys = _mm512_loadu_si512(block + i);
+                count += __builtin_popcount(_mm512_cmplt_epi32_mask(keys, needle));
+            }
+        } else {
+            __m512i needle = _mm512_set1_epi64(key);
+            for (size_type i = 0; i < block_keys; i += 8) {
+                __m512i keys = _mm512_loadu_si512(block + i);
+                count += __builtin_popcount(_mm512_cmplt_epi64_mask(keys, needle));
+            }
+        }
+#elif defined(__AVX2__)
+        if constexpr (sizeof(Key) == 4) {
+            __m256i needle = _mm256_set1_epi32(key);
+            for (size_type i = 0; i < block_keys; i += 8) {
+                __m256i keys = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block + i));
+                count += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(needle, keys))));
+            }
+        } else {
+            __m256i needle = _mm256_set1_epi64x(key);
+            for (size_type i = 0; i < block_keys; i += 4) {
+                __m256i keys = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block + i));
+                count += __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(needle, keys))));
+            }
+        }
+#else
+        for (size_type i = 0; i < block_keys; i++) {
+            count += block[i] < key;
+        }
+#endif
+        return count;
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,269 @@
+#ifndef HSF_STATS_H
+#define HSF_STATS_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+
+#include "epoch.h"
+
+namespace hsf {
+
+// Telemetry of a forest, chosen by its policy's stats_type. The forest
+// reports every lookup's outcome, every key moved between levels, the end
+// of every locked operation and, in learned forests, every prediction.
+struct null_stats {
+    static constexpr bool enabled = false;
+
+    void hit(size_t) const {}
+    void miss() const {}
+    void move(size_t, size_t) const {}
+    void end_operation() const {}
+    void prediction(size_t, size_t) const {}
+};
+
+// Counts hits per level, misses and promotions, and keeps histograms of the
+// keys moved by and depth of each compaction cascade (the downward moves of
+// one operation) and of the distance between predicted and actual levels.
+//
+// Each thread adds to its own cache-line aligned shard without read-modify-
+// write instructions; threads beyond the first `shards` share an overflow
+// shard updated atomically. collect() sums all shards and may run at any
+// time, e.g. from an exporter thread.
+class level_stats {
+public:
+    static constexpr bool enabled = true;
+    static constexpr size_t max_levels = 64;
+    static constexpr size_t shards = 32;
+
+    // Buckets hold values 0, 1, 2, (2, 4], ..., (2^12, 2^13] and above.
+    static constexpr size_t buckets = 16;
+
+    struct histogram {
+        std::array<uint64_t, buckets> counts{};
+        uint64_t sum = 0;
+
+        uint64_t count() const {
+            uint64_t total = 0;
+            for (uint64_t count : counts) {
+                total += count;
+            }
+            return total;
+        }
+    };
+
+    struct snapshot {
+        std::array<uint64_t, max_levels> hits{};
+        uint64_t misses = 0;
+        uint64_t promotions = 0;
+        histogram cascade_keys;
+        histogram cascade_depth;
+        histogram misprediction_distance;
+    };
+
+    level_stats() = default;
+    level_stats(const level_stats&) = delete;
+    level_stats& operator=(const level_stats&) = delete;
+
+    void hit(size_t level) const {
+        add(local().hits[std::min(level, max_levels - 1)], 1);
+    }
+
+    void miss() const {
+        add(local().misses, 1);
+    }
+
+    void move(size_t from_level, size_t to_level) const {
+        if (to_level < from_level) {
+            add(local().promotions, 1);
+            return;
+        }
+
+        auto& current = cascade();
+        if (current.keys == 0) {
+            current.first = from_level;
+            current.last = to_level;
+        }
+        current.first = std::min(current.first, from_level);
+        current.last = std::max(current.last, to_level);
+        current.keys++;
+    }
+
+    void end_operation() const {
+        auto& current = cascade();
+        if (current.keys != 0) {
+            auto& shard = local();
+            record(shard.cascade_keys, current.keys);
+            record(shard.cascade_depth, current.last - current.first);
+            current.keys = 0;
+        }
+    }
+
+    void prediction(size_t predicted, size_t actual) const {
+        record(local().misprediction_distance, predicted < actual ? actual - predicted : predicted - actual);
+    }
+
+    snapshot collect() const {
+        snapshot result;
+        for (size_t s = 0; s <= shards; s++) {
+            const auto& shard = shards_[s];
+            for (size_t i = 0; i < max_levels; i++) {
+                result.hits[i] += shard.hits[i].load(std::memory_order_relaxed);
+            }
+            result.misses += shard.misses.load(std::memory_order_relaxed);
+            result.promotions += shard.promotions.load(std::memory_order_relaxed);
+            merge(result.cascade_keys, shard.cascade_keys);
+            merge(result.cascade_depth, shard.cascade_depth);
+            merge(result.misprediction_distance, shard.misprediction_distance);
+        }
+        return result;
+    }
+
+    // Writes the counters in the Prometheus text format, labelled with
+    // forest="<name>".
+    void write_prometheus(std::ostream& out, const std::string& name) const {
+        auto stats = collect();
+        std::string label = "forest=\"" + name + "\"";
+
+        size_t levels = max_levels;
+        while (levels > 0 && stats.hits[levels - 1] == 0) {
+            levels--;
+        }
+        out << "# HELP hsf_level_hits_total Lookups that found their key, by level.\n"
+            << "# TYPE hsf_level_hits_total counter\n";
+        for (size_t i = 0; i < levels; i++) {
+            out << "hsf_level_hits_total{" << label << ",level=\"" << i << "\"} " << stats.hits[i] << '\n';
+        }
+
+        out << "# HELP hsf_misses_total Lookups that did not find their key.\n"
+            << "# TYPE hsf_misses_total counter\n"
+            << "hsf_misses_total{" << label << "} " << stats.misses << '\n'
+            << "# HELP hsf_promotions_total Keys moved to a higher level.\n"
+            << "# TYPE hsf_promotions_total counter\n"
+            << "hsf_promotions_total{" << label << "} " << stats.promotions << '\n';
+
+        write_histogram(out, "hsf_cascade_keys_moved", "Keys moved down by each compaction cascade.", label, stats.cascade_keys);
+        write_histogram(out, "hsf_cascade_depth", "Levels crossed by each compaction cascade.", label, stats.cascade_depth);
+        write_histogram(out, "hsf_misprediction_distance", "Levels between predicted and actual levels of hits.", label, stats.misprediction_distance);
+    }
+
+    // Replaces `path` with the current counters, e.g. for node_exporter's
+    // textfile collector, by writing a temporary file and renaming it.
+    void export_prometheus(const std::string& path, const std::string& name) const {
+        std::string temporary = path + ".tmp";
+        {
+            std::ofstream out(temporary);
+            write_prometheus(out, name);
+            if (!out) {
+                throw std::runtime_error("level_stats: cannot write " + temporary);
+            }
+        }
+        if (std::rename(temporary.c_str(), path.c_str()) != 0) {
+            throw std::runtime_error("level_stats: cannot replace " + path);
+        }
+    }
+
+private:
+    using counter = std::atomic<uint64_t>;
+
+    struct shard_histogram {
+        std::array<counter, buckets> counts{};
+        counter sum{0};
+    };
+
+    struct alignas(64) shard {
+        std::array<counter, max_levels> hits{};
+        counter misses{0};
+        counter promotions{0};
+        shard_histogram cascade_keys;
+        shard_histogram cascade_depth;
+        shard_histogram misprediction_distance;
+    };
+
+    struct pending_cascade {
+        size_t keys = 0;
+        size_t first = 0;
+        size_t last = 0;
+    };
+
+    // Threads take the small ids of epoch_thread_id, which are recycled on
+    // thread exit, so only threads beyond the first `shards` alive at once
+    // use the overflow shard. A recycled id's shard keeps its counts.
+    static size_t thread_index() {
+        thread_local size_t index = std::min(epoch_thread_id(), shards);
+        return index;
+    }
+
+    // The operation in progress on this thread; operations do not nest.
+    static pending_cascade& cascade() {
+        thread_local pending_cascade current;
+        return current;
+    }
+
+    static void add(counter& value, uint64_t n) {
+        if (thread_index() < shards) {
+            value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+        } else {
+            value.fetch_add(n, std::memory_order_relaxed);
+        }
+    }
+
+    static size_t bucket_of(uint64_t value) {
+        size_t bucket = 0;
+        while (bucket + 1 < buckets && value > upper_bound(bucket)) {
+            bucket++;
+        }
+        return bucket;
+    }
+
+    static uint64_t upper_bound(size_t bucket) {
+        return bucket == 0 ? 0 : uint64_t(1) << (bucket - 1);
+    }
+
+    static void record(shard_histogram& target, uint64_t value) {
+        add(target.counts[bucket_of(value)], 1);
+        add(target.sum, value);
+    }
+
+    static void merge(histogram& target, const shard_histogram& source) {
+        for (size_t i = 0; i < buckets; i++) {
+            target.counts[i] += source.counts[i].load(std::memory_order_relaxed);
+        }
+        target.sum += source.sum.load(std::memory_order_relaxed);
+    }
+
+    static void write_histogram(std::ostream& out, const char* metric, const char* help, const std::string& label, const histogram& values) {
+        out << "# HELP " << metric << ' ' << help << '\n'
+            << "# TYPE " << metric << " histogram\n";
+        uint64_t cumulative = 0;
+        for (size_t i = 0; i < buckets; i++) {
+            cumulative += values.counts[i];
+            out << metric << "_bucket{" << label << ",le=\"";
+            if (i + 1 < buckets) {
+                out << upper_bound(i);
+            } else {
+                out << "+Inf";
+            }
+            out << "\"} " << cumulative << '\n';
+        }
+        out << metric << "_sum{" << label << "} " << values.sum << '\n'
+            << metric << "_count{" << label << "} " << cumulative << '\n';
+    }
+
+    std::unique_ptr<shard[]> shards_{new shard[shards + 1]};
+
+    shard& local() const {
+        return shards_[thread_index()];
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,171 @@
+#ifndef HSF_STRING_KEY_H
+#define HSF_STRING_KEY_H
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+namespace hsf {
+
+// Immutable string key. Its characters live once in a reference-counted
+// buffer shared by every copy, so a forest's level and its frequency or
+// recency metadata hold 16-byte handles to the same string. The first eight
+// bytes are cached big-endian in the handle: keys that differ there compare
+// as integers without touching the buffer.
+//
+// Also compares with std::string_view and other strings, so forests with a
+// transparent comparator such as std::less<> are searched by view without
+// building a key.
+class string_key {
+    // Strings other than keys, e.g. std::string_view, std::string or literals.
+    template <typename View>
+    using if_view = std::enable_if_t<std::is_convertible_v<const View&, std::string_view> 
+        && !std::is_same_v<View, string_key>>;
+
+public:
+    string_key() : prefix_(0), buffer_(nullptr) {}
+
+    string_key(std::string_view value) : prefix_(prefix_of(value)), buffer_(nullptr) {
+        if (!value.empty()) {
+            assert(value.size() <= UINT32_MAX);
+            buffer_ = static_cast<buffer*>(::operator new(sizeof(buffer) + value.size()));
+            new (&buffer_->refs) std::atomic<uint32_t>(1);
+            buffer_->size = static_cast<uint32_t>(value.size());
+            std::memcpy(reinterpret_cast<char*>(buffer_ + 1), value.data(), value.size());
+        }
+    }
+
+    string_key(const std::string& value) : string_key(std::string_view(value)) {}
+    string_key(const char* value) : string_key(std::string_view(value)) {}
+
+    string_key(const string_key& other) : prefix_(other.prefix_), buffer_(other.buffer_) {
+        if (buffer_ != nullptr) {
+            buffer_->refs.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    string_key(string_key&& other) noexcept : prefix_(other.prefix_), buffer_(other.buffer_) {
+        other.prefix_ = 0;
+        other.buffer_ = nullptr;
+    }
+
+    string_key& operator=(string_key other) noexcept {
+        std::swap(prefix_, other.prefix_);
+        std::swap(buffer_, other.buffer_);
+        return *this;
+    }
+
+    ~string_key() {
+        if (buffer_ != nullptr && buffer_->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            buffer_->refs.~atomic();
+            ::operator delete(buffer_);
+        }
+    }
+
+    std::string_view view() const {
+        if (buffer_ == nullptr) {
+            return {};
+        }
+        return {reinterpret_cast<const char*>(buffer_ + 1), buffer_->size};
+    }
+
+    operator std::string_view() const {
+        return view();
+    }
+
+    size_t size() const {
+        return buffer_ == nullptr ? 0 : buffer_->size;
+    }
+
+    friend bool operator<(const string_key& left, const string_key& right) {
+        if (left.prefix_ != right.prefix_) {
+            return left.prefix_ < right.prefix_;
+        }
+        return left.view() < right.view();
+    }
+
+    template <typename View, typename = if_view<View>>
+    friend bool operator<(const string_key& left, const View& right) {
+        std::string_view view(right);
+        uint64_t prefix = prefix_of(view);
+        if (left.prefix_ != prefix) {
+            return left.prefix_ < prefix;
+        }
+        return left.view() < view;
+    }
+
+    template <typename View, typename = if_view<View>>
+    friend bool operator<(const View& left, const string_key& right) {
+        std::string_view view(left);
+        uint64_t prefix = prefix_of(view);
+        if (prefix != right.prefix_) {
+            return prefix < right.prefix_;
+        }
+        return view < right.view();
+    }
+
+    friend bool operator==(const string_key& left, const string_key& right) {
+        return left.prefix_ == right.prefix_ && left.view() == right.view();
+    }
+
+    friend bool operator!=(const string_key& left, const string_key& right) {
+        return !(left == right);
+    }
+
+    template <typename View, typename = if_view<View>>
+    friend bool operator==(const string_key& left, const View& right) {
+        return left.view() == std::string_view(right);
+    }
+
+private:
+    struct buffer {
+        std::atomic<uint32_t> refs;
+        uint32_t size;
+    };
+
+    uint64_t prefix_;
+    buffer* buffer_;
+
+    // Zero padding orders a string before its extensions, so unequal prefixes
+    // order strings as std::string_view does; equal ones need the full compare.
+    static uint64_t prefix_of(std::string_view value) {
+        unsigned char bytes[8] = {};
+        if (!value.empty()) {
+            std::memcpy(bytes, value.data(), std::min<size_t>(8, value.size()));
+        }
+        uint64_t prefix = 0;
+        for (unsigned char byte : bytes) {
+            prefix = prefix << 8 | byte;
+        }
+        return prefix;
+    }
+};
+
+}
+
+namespace std {
+
+template <>
+struct hash<hsf::string_key> {
+    using is_transparent = void;
+
+    size_t operator()(const hsf::string_key& key) const {
+        return std::hash<std::string_view>{}(key.view());
+    }
+
+    size_t operator()(std::string_view key) const {
+        return std::hash<std::string_view>{}(key);
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,205 @@
+#ifndef HSF_TUNING_H
+#define HSF_TUNING_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+#include <vector>
+
+#include "hsf.h"
+#include "stats.h"
+
+namespace hsf {
+
+// Re-derives a forest's capacity(fill_factor, base, top_size) schedule from
+// the hits its level_stats counted per level since the last retune, so that
+// the schedule follows a shifting access distribution. Keys are ranked by
+// level, each level taking the share of hits counted for it, spread over
+// its keys as a Zipf law fitted to all levels' shares would. The tuner then
+// picks the base and top size minimizing the expected key comparisons of a
+// lookup that searches the levels top-down, as frequency and recency
+// forests do, at log2(size + 1) per level searched; misses search every
+// level. Keys moved between levels count as a removal and an insertion,
+// 2 log2(keys + 1) comparisons, at the rate observed per level a hit was
+// found below the top, which penalizes small levels in forests that move
+// keys on every hit. Schedules keep at least two levels, so that hits keep
+// revealing the skew.
+class capacity_tuner {
+public:
+    explicit capacity_tuner(double min_fill = 1.0, double max_fill = 1.0, double min_gain = 0.05, uint64_t min_lookups = 10000)
+        : min_fill_(min_fill), max_fill_(max_fill), min_gain_(min_gain), min_lookups_(min_lookups) {}
+
+    // Reshapes the forest if a schedule is expected to save at least
+    // `min_gain` of the comparisons its current levels cost; returns whether
+    // it did. Waits for `min_lookups` lookups since the last retune. The
+    // first call, and the first after a reshape, only start counting, so
+    // that neither loading the forest nor reshaping it counts as moves of
+    // its lookups. Not safe to call concurrently with the forest's
+    // operations.
+    template <typename Forest>
+    bool retune(Forest& forest) {
+        static_assert(Forest::stats_type::enabled, "capacity_tuner: the forest must count hits, e.g. with with_stats");
+        static_assert(std::is_same_v<typename Forest::capacity_type, capacity>, "capacity_tuner: the forest must use hsf::capacity");
+
+        auto stats = forest.stats().collect();
+        if (!counting_) {
+            last_ = stats;
+            counting_ = true;
+            return false;
+        }
+
+        uint64_t misses = stats.misses - last_.misses;
+        uint64_t lookups = misses;
+        for (size_t i = 0; i < level_stats::max_levels; i++) {
+            lookups += stats.hits[i] - last_.hits[i];
+        }
+        if (lookups < min_lookups_) {
+            return false;
+        }
+
+        size_t keys = forest.size();
+        size_t levels = std::min<size_t>(forest.levels(), level_stats::max_levels);
+        offsets_.assign(1, 0);
+        shares_.assign(1, 0);
+        double current = 0;
+        double searched = 0;
+        double depth = 0;
+        for (size_t i = 0; i < levels; i++) {
+            uint64_t hits = stats.hits[i] - last_.hits[i];
+            offsets_.push_back(offsets_.back() + forest.size(i));
+            shares_.push_back(shares_.back() + double(hits) / lookups);
+            searched += std::log2(forest.size(i) + 1);
+            current += searched * hits / lookups;
+            depth += double(i) * hits / lookups;
+        }
+        current += searched * misses / lookups;
+
+        double moves = double(stats.promotions - last_.promotions + stats.cascade_keys.sum - last_.cascade_keys.sum) / lookups;
+        move_cost_ = 2 * std::log2(keys + 1) * (depth > 0 ? moves / depth : 1);
+        current += 2 * std::log2(keys + 1) * moves;
+        last_ = stats;
+        fit_skew();
+
+        double best = current;
+        double best_base = base_;
+        size_t best_top_size = top_size_;
+        for (double base : bases) {
+            for (size_t top_size = 2; top_size / 2 < keys; top_size *= 2) {
+                double cost = expected_comparisons(capacity(min_fill_, base, top_size), keys, double(misses) / lookups);
+                if (cost < best) {
+                    best = cost;
+                    best_base = base;
+                    best_top_size = top_size;
+                }
+            }
+        }
+
+        if (best > current * (1 - min_gain_) || (best_base == base_ && best_top_size == top_size_)) {
+            return false;
+        }
+        base_ = best_base;
+        top_size_ = best_top_size;
+        forest.reshape(capacity(min_fill_, base_, top_size_), capacity(max_fill_, base_, top_size_));
+        counting_ = false;
+        return true;
+    }
+
+    // The base and top size of the last schedule applied, if any.
+    double base() const {
+        return base_;
+    }
+
+    size_t top_size() const {
+        return top_size_;
+    }
+
+private:
+    static constexpr double bases[] = {1.1, 1.25, 1.5, 1.75, 2.0, 2.5, 3.0, 4.0};
+    static constexpr size_t max_levels = 64;
+    static constexpr double max_skew = 3;
+
+    // The comparisons per lookup, moves included, with the forest's keys in
+    // levels of the given capacities, or infinity if they would need too
+    // many levels or just one.
+    double expected_comparisons(const capacity& schedule, size_t keys, double miss_rate) const {
+        double cost = 0;
+        double searched = 0;
+        size_t offset = 0;
+        for (size_t level = 0; offset < keys; level++) {
+            size_t size = std::min(std::max<size_t>(schedule(level), 1), keys - offset);
+            if (level == max_levels || (level == 0 && size == keys)) {
+                return std::numeric_limits<double>::infinity();
+            }
+
+            searched += std::log2(size + 1);
+            cost += (searched + move_cost_ * level) * (share_of(offset + size) - share_of(offset));
+            offset += size;
+        }
+        return cost + searched * miss_rate;
+    }
+
+    // The unnormalized share of hits on the `rank` highest ranked keys under
+    // a Zipf law of exponent `skew`, by the integral of x^-skew.
+    static double zipf(double rank, double skew) {
+        if (std::abs(skew - 1) < 1e-9) {
+            return std::log(2 * rank + 1);
+        }
+        return (std::pow(rank + 0.5, 1 - skew) - std::pow(0.5, 1 - skew)) / (1 - skew);
+    }
+
+    // Fits the exponent whose Zipf law best matches, in least squares, the
+    // shares of hits above each level boundary.
+    void fit_skew() {
+        double total = offsets_.back();
+        double hits = shares_.back();
+        skew_ = 1;
+        if (offsets_.size() <= 2 || total == 0 || hits == 0) {
+            return;
+        }
+
+        double best = std::numeric_limits<double>::infinity();
+        for (double skew = 0; skew <= max_skew; skew += 0.05) {
+            double error = 0;
+            for (size_t i = 1; i + 1 < offsets_.size(); i++) {
+                double gap = zipf(offsets_[i], skew) / zipf(total, skew) - shares_[i] / hits;
+                error += gap * gap;
+            }
+            if (error < best) {
+                best = error;
+                skew_ = skew;
+            }
+        }
+    }
+
+    // The share of lookups that hit the `rank` highest ranked keys: the
+    // shares counted down to the rank's level, plus the part of its level's
+    // share the fitted Zipf law puts above the rank.
+    double share_of(size_t rank) const {
+        size_t i = std::upper_bound(offsets_.begin(), offsets_.end(), rank) - offsets_.begin();
+        if (i == offsets_.size()) {
+            return shares_.back();
+        }
+        double first = zipf(offsets_[i - 1], skew_);
+        double part = (zipf(rank, skew_) - first) / (zipf(offsets_[i], skew_) - first);
+        return shares_[i - 1] + part * (shares_[i] - shares_[i - 1]);
+    }
+
+    double min_fill_;
+    double max_fill_;
+    double min_gain_;
+    uint64_t min_lookups_;
+    double base_ = 0;
+    size_t top_size_ = 0;
+    level_stats::snapshot last_;
+    bool counting_ = false;
+    double skew_ = 1;
+    double move_cost_ = 0;
+    std::vector<size_t> offsets_;
+    std::vector<double> shares_;
+};
+
+}
+
+#endif